@@ -1,2 +1,2 @@
-g++ -O3 src/main.cpp -o grainsim.out -static
+g++ -O3 -pthread src/main.cpp -o grainsim.out -static
 PAUSE
\ No newline at end of file
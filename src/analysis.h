@@ -2,183 +2,140 @@
 #include <iostream>
 #include <fstream>
 #include <unordered_map>
+#include <vector>
 
 #include "types.h"
 #include "lattice.h"
+#include "analysis_archive.h"
 
+// Writes the analysis files. All statistics are maintained incrementally by the lattice (volumes by its grain index, the rest
+// through the analysis feature), so writing a file only costs O(grains + boundaries).
+// load_lattice() copies the statistics out of the lattice (with their original grain IDs), so that the file can be written
+// afterwards (e.g. by a background writer) while the lattice keeps changing.
 class lattice_analyzer_t
 {
 private:
 
 	lattice_t *curr_cube;
 
-	spin_t max_grains;
-	spin_t calculate_max_grains()
-	{
-		spin_t max_so_far = 0;
-		for (coord_t z = 0; z < curr_cube->side_length; ++z)
-			for (coord_t y = 0; y < curr_cube->side_length; ++y)
-				for (coord_t x = 0; x < curr_cube->side_length; ++x)
-				{
-					spin_t curr_spin = curr_cube->voxel_at(x, y, z)->spin;
-					if (curr_spin > max_so_far) max_so_far = curr_spin;
-				}
-		return max_so_far;
-	}
+	// The pair statistics of the lattice (indexed by the smaller spin of each pair).
+	std::vector<std::unordered_map<spin_t, pair_stats_t> > *sparse_info_matrix;
 
-#pragma pack(push, 1)
-	struct boundary_info_t
+	// A grain pair with a shared surface.
+	struct pair_record_t
 	{
-		int sm_to_lg_outies = 0,
-			sm_to_lg_delta = 0,
-			lg_to_sm_outies = 0,
-			lg_to_sm_delta = 0,
-			surface_area = 0;
+		spin_t sm_label, lg_label;
+		double sm_curvature, lg_curvature;
+		int surface_area;
 	};
-#pragma pack(pop)
-	std::unordered_map<spin_t, std::unordered_map<spin_t, boundary_info_t> > sparse_info_matrix;
-	std::unordered_map<spin_t, size_t> vol_map;
-
-	void incr_sparse_outies(spin_t a, spin_t b)
-	{
-		if (a > b)
-		{
-			++sparse_info_matrix[b][a].lg_to_sm_outies;
-		}
-		else if (a < b)
-		{
-			++sparse_info_matrix[a][b].sm_to_lg_outies;
-		}
-	}
-	void incr_sparse_delta(spin_t a, spin_t b)
-	{
-		if (a > b)
-		{
-			++sparse_info_matrix[b][a].lg_to_sm_delta;
-		}
-		else if (a < b)
-		{
-			++sparse_info_matrix[a][b].sm_to_lg_delta;
-		}
-	}
-	void incr_sparse_sa(spin_t a, spin_t b)
+	// A grain pair whose boundary has moved since the last analysis file.
+	struct velocity_record_t
 	{
-		++sparse_info_matrix[a > b ? b : a][a > b ? a : b].surface_area;
-	}
+		spin_t sm_label, lg_label;
+		int delta;
+	};
+
+	// The statistics copied out of the lattice.
+	std::vector<std::pair<spin_t, size_t> > volumes;
+	std::vector<pair_record_t> pairs;
+	std::vector<velocity_record_t> velocities;
+	// The grain IDs of each boundary's pair followed by the pairs of its junctions, and the end of each boundary's entries.
+	std::vector<spin_t> adjacency_labels;
+	std::vector<size_t> adjacency_ends;
 
-	void check_edge(
-		coord_t rx, coord_t ry, coord_t rz,
-		coord_t x1, coord_t y1, coord_t z1,
-		coord_t x2, coord_t y2, coord_t z2,
-		coord_t x3, coord_t y3, coord_t z3,
-		coord_t x4, coord_t y4, coord_t z4)
+public:
+
+	// Copy the statistics out of a lattice (and reset its boundary velocities, which are measured between analysis files).
+	void load_lattice(lattice_t *cube)
 	{
-		spin_t id1, id2, id3, id4;
+		curr_cube = cube;
+		sparse_info_matrix = &cube->analysis_tracker.pair_stats;
 
-		id1 = curr_cube->voxel_at(rx + x1, ry + y1, rz + z1)->spin;
-		id2 = curr_cube->voxel_at(rx + x2, ry + y2, rz + z2)->spin;
-		id3 = curr_cube->voxel_at(rx + x3, ry + y3, rz + z3)->spin;
-		id4 = curr_cube->voxel_at(rx + x4, ry + y4, rz + z4)->spin;
+		volumes.clear();
+		pairs.clear();
+		velocities.clear();
+		adjacency_labels.clear();
+		adjacency_ends.clear();
 
-		if (id1 != id2 && id2 == id3 && id2 == id4)
+		// Volumes
+		for (spin_t spin = 1; spin <= curr_cube->spin_count; ++spin)
 		{
-			incr_sparse_outies(id1, id2);
+			size_t volume = curr_cube->grain_record(spin).volume;
+			if (volume == 0) continue;
+
+			volumes.push_back(std::make_pair(curr_cube->original_spin(spin), volume));
 		}
-		else if (id2 != id1 && id1 == id3 && id1 == id4)
+
+		// Curvatures and surface areas
+		for (spin_t sm_spin = 1; sm_spin < sparse_info_matrix->size(); ++sm_spin)
 		{
-			incr_sparse_outies(id2, id1);
+			for (auto lg_iter = (*sparse_info_matrix)[sm_spin].begin(); lg_iter != (*sparse_info_matrix)[sm_spin].end(); ++lg_iter)
+			{
+				if (lg_iter->second.surface_area == 0) continue;
+
+				pair_record_t record;
+				record.sm_label = curr_cube->original_spin(sm_spin);
+				record.lg_label = curr_cube->original_spin(lg_iter->first);
+				record.sm_curvature = get_curvature(sm_spin, lg_iter->first);
+				record.lg_curvature = get_curvature(lg_iter->first, sm_spin);
+				record.surface_area = lg_iter->second.surface_area;
+				pairs.push_back(record);
+			}
 		}
-		else if (id3 != id1 && id1 == id2 && id1 == id4)
+
+		// Velocities
+		std::vector<std::unordered_map<spin_t, std::pair<int, int> > > *velocity_tracker = &curr_cube->boundary_tracker.velocity_tracker;
+		for (spin_t sm_spin = 1; sm_spin < velocity_tracker->size(); ++sm_spin)
 		{
-			incr_sparse_outies(id3, id1);
+			for (auto lg_iter = (*velocity_tracker)[sm_spin].begin(); lg_iter != (*velocity_tracker)[sm_spin].end(); ++lg_iter)
+			{
+				velocity_record_t record;
+				record.sm_label = curr_cube->original_spin(sm_spin);
+				record.lg_label = curr_cube->original_spin(lg_iter->first);
+				record.delta = lg_iter->second.first - lg_iter->second.second;
+				velocities.push_back(record);
+			}
 		}
-		else if (id4 != id1 && id1 == id2 && id1 == id3)
+
+		// Adjacent boundaries
+		std::vector<std::unordered_map<spin_t, boundary_t *> > *boundary_map = &curr_cube->boundary_tracker.boundary_map;
+		for (auto sm_iter = boundary_map->begin(); sm_iter != boundary_map->end(); ++sm_iter)
 		{
-			incr_sparse_outies(id4, id1);
-		}
-	}
+			for (auto lg_iter = sm_iter->begin(); lg_iter != sm_iter->end(); ++lg_iter)
+			{
+				boundary_t *boundary = lg_iter->second;
 
-	size_t matrix_dim = 0;
-	void generate_matrices()
-	{
-		sparse_info_matrix.clear();
-		vol_map.clear();
+				if (boundary->area() == 0) continue;
 
-		for(coord_t z = 0; z < curr_cube->side_length; ++z)
-			for (coord_t y = 0; y < curr_cube->side_length; ++y)
-				for (coord_t x = 0; x < curr_cube->side_length; ++x)
+				adjacency_labels.push_back(curr_cube->original_spin(boundary->a_spin));
+				adjacency_labels.push_back(curr_cube->original_spin(boundary->b_spin));
+				for (auto junc_iter = boundary->junctions.begin(); junc_iter != boundary->junctions.end(); ++junc_iter)
 				{
-					spin_t
-						curr_id = curr_cube->voxel_at(x, y, z)->spin,
-						fwd_id = curr_cube->voxel_at(x, y, z + 1)->spin,
-						right_id = curr_cube->voxel_at(x + 1, y, z)->spin,
-						up_id = curr_cube->voxel_at(x, y + 1, z)->spin;
-
-					if (curr_id != right_id)
-					{
-						incr_sparse_sa(curr_id, right_id);
-					}
-					if (curr_id != fwd_id)
-					{
-						incr_sparse_sa(curr_id, fwd_id);
-					}
-					if (curr_id != up_id)
-					{
-						incr_sparse_sa(curr_id, up_id);
-					}
-
-					// back bottom
-					check_edge(
-						x, y, z,
-						0, 0, -1, 
-						0, 0, 0,
-						0, -1, 0,
-						0, -1, -1);
-					// back left
-					check_edge(
-						x, y, z,
-						-1, 0, 0,
-						0, 0, 0, 
-						0, 0, -1, 
-						-1, 0, -1);
-					// top left
-					check_edge(
-						x, y, z,
-						-1, 1, 0, 
-						0, 1, 0,
-						0, 0, 0,
-						-1, 0, 0);
-
-					++vol_map[curr_id];
+					adjacency_labels.push_back(curr_cube->original_spin(junc_iter->first->a_spin));
+					adjacency_labels.push_back(curr_cube->original_spin(junc_iter->first->b_spin));
 				}
+				adjacency_ends.push_back(adjacency_labels.size());
+			}
+		}
 
-	}
-
-public:
-
-	void load_lattice(lattice_t *cube)
-	{
-		curr_cube = cube;
-		max_grains = calculate_max_grains();
-		matrix_dim = max_grains + 1;
-
-		generate_matrices();
+		curr_cube->boundary_tracker.reset_flip_tracker();
 	}
 
 	double get_curvature(spin_t a, spin_t b) // DOES NOT VERIFY THAT BOUNDARY EXISTS!!!!!
 	{
 		if (a > b)
 		{
-			return (3.141592653589793 / 4.0) * (sparse_info_matrix[b][a].lg_to_sm_outies - sparse_info_matrix[b][a].sm_to_lg_outies);
+			return (3.141592653589793 / 4.0) * ((*sparse_info_matrix)[b][a].lg_to_sm_outies - (*sparse_info_matrix)[b][a].sm_to_lg_outies);
 		}
 		else if (a < b)
 		{
-			return (3.141592653589793 / 4.0) * (sparse_info_matrix[a][b].sm_to_lg_outies - sparse_info_matrix[a][b].lg_to_sm_outies);
+			return (3.141592653589793 / 4.0) * ((*sparse_info_matrix)[a][b].sm_to_lg_outies - (*sparse_info_matrix)[a][b].lg_to_sm_outies);
 		}
 		return 0;
 	}
 
-	void save_analysis_to_file(const char *fname)
+	// Write the statistics copied by load_lattice() to an analysis file (without touching the lattice).
+	void save_analysis_to_file(const char *fname) const
 	{
 		std::ofstream afile(fname);
 
@@ -186,71 +143,116 @@ public:
 
 		// Volumes
 		afile << "VOLUMES\n";
-		for (auto vol_iter = vol_map.begin(); vol_iter != vol_map.end(); ++vol_iter)
+		for (auto volume_iter = volumes.begin(); volume_iter != volumes.end(); ++volume_iter)
 		{
-			afile << vol_iter->first << ' ' << vol_iter->second << '\n';
+			afile << volume_iter->first << ' ' << volume_iter->second << '\n';
 		}
 
 		// Curvatures
 		afile << "CURVATURES\n";
-		for (auto sm_iter = sparse_info_matrix.begin(); sm_iter != sparse_info_matrix.end(); ++sm_iter)
+		for (auto pair_iter = pairs.begin(); pair_iter != pairs.end(); ++pair_iter)
 		{
-			for (auto lg_iter = sm_iter->second.begin(); lg_iter != sm_iter->second.end(); ++lg_iter)
-			{
-				if (lg_iter->second.surface_area == 0) continue;
-
-				afile << sm_iter->first << ' ' << lg_iter->first << ' ' << get_curvature(sm_iter->first, lg_iter->first) << '\n';
-				afile << lg_iter->first << ' ' << sm_iter->first << ' ' << get_curvature(lg_iter->first, sm_iter->first) << '\n';
-			}
+			afile << pair_iter->sm_label << ' ' << pair_iter->lg_label << ' ' << pair_iter->sm_curvature << '\n';
+			afile << pair_iter->lg_label << ' ' << pair_iter->sm_label << ' ' << pair_iter->lg_curvature << '\n';
 		}
 
 		// Curvatures
 		afile << "SURFACE_AREAS\n";
-		for (auto sm_iter = sparse_info_matrix.begin(); sm_iter != sparse_info_matrix.end(); ++sm_iter)
+		for (auto pair_iter = pairs.begin(); pair_iter != pairs.end(); ++pair_iter)
 		{
-			for (auto lg_iter = sm_iter->second.begin(); lg_iter != sm_iter->second.end(); ++lg_iter)
-			{
-				if (lg_iter->second.surface_area == 0) continue;
-
-				afile << sm_iter->first << ' ' << lg_iter->first << ' ' << lg_iter->second.surface_area << '\n';
-				afile << lg_iter->first << ' ' << sm_iter->first << ' ' << lg_iter->second.surface_area << '\n';
-			}
+			afile << pair_iter->sm_label << ' ' << pair_iter->lg_label << ' ' << pair_iter->surface_area << '\n';
+			afile << pair_iter->lg_label << ' ' << pair_iter->sm_label << ' ' << pair_iter->surface_area << '\n';
 		}
 
 		// Velocities
 		afile << "VELOCITIES\n";
-		for (auto sm_iter = curr_cube->boundary_tracker.velocity_tracker.begin(); sm_iter != curr_cube->boundary_tracker.velocity_tracker.end(); ++sm_iter)
+		for (auto velocity_iter = velocities.begin(); velocity_iter != velocities.end(); ++velocity_iter)
 		{
-			for (auto lg_iter = sm_iter->second.begin(); lg_iter != sm_iter->second.end(); ++lg_iter)
-			{
-				std::pair<int, int> delta = lg_iter->second;
-				
-				afile << sm_iter->first << ' ' << lg_iter->first << ' ' << (delta.first - delta.second) << '\n';
-				afile << lg_iter->first << ' ' << sm_iter->first << ' ' << (delta.second - delta.first) << '\n';
-			}
+			afile << velocity_iter->sm_label << ' ' << velocity_iter->lg_label << ' ' << velocity_iter->delta << '\n';
+			afile << velocity_iter->lg_label << ' ' << velocity_iter->sm_label << ' ' << -velocity_iter->delta << '\n';
 		}
 
 		afile << "ADJACENT_BOUNDARIES\n";
-		for (auto sm_iter = curr_cube->boundary_tracker.boundary_map.begin(); sm_iter != curr_cube->boundary_tracker.boundary_map.end(); ++sm_iter)
+		size_t begin = 0;
+		for (auto end_iter = adjacency_ends.begin(); end_iter != adjacency_ends.end(); ++end_iter)
 		{
-			for (auto lg_iter = sm_iter->second.begin(); lg_iter != sm_iter->second.end(); ++lg_iter)
+			afile << adjacency_labels[begin] << '/' << adjacency_labels[begin + 1];
+			for (size_t i = begin + 2; i < *end_iter; i += 2)
 			{
-				boundary_t *boundary = lg_iter->second;
+				afile << ' ' << adjacency_labels[i] << '/' << adjacency_labels[i + 1];
+			}
 
-				if (boundary->area() == 0) continue;
+			afile << '\n';
+			begin = *end_iter;
+		}
 
-				afile << boundary->a_spin << '/' << boundary->b_spin;
-				for (auto junc_iter = boundary->junctions.begin(); junc_iter != boundary->junctions.end(); ++junc_iter)
-				{
-					afile << ' ' << junc_iter->first->a_spin << '/' << junc_iter->first->b_spin;
-				}
+		afile.close();
+	}
 
-				afile << '\n';
-			}
+	// Append the statistics copied by load_lattice() to a binary archive as a block of columns (every pair is stored once).
+	void save_analysis_to_archive(analysis_archive_t *archive, double timestep) const
+	{
+		std::cout << "Appending analysis data for T = " << timestep << std::endl;
+
+		std::vector<uint32_t> volume_grains(volumes.size());
+		std::vector<uint64_t> volume_values(volumes.size());
+		for (size_t i = 0; i < volumes.size(); ++i)
+		{
+			volume_grains[i] = volumes[i].first;
+			volume_values[i] = volumes[i].second;
 		}
 
-		curr_cube->boundary_tracker.reset_flip_tracker();
+		std::vector<uint32_t> pair_smaller(pairs.size()), pair_larger(pairs.size());
+		std::vector<int32_t> pair_areas(pairs.size());
+		std::vector<double> pair_curvatures(pairs.size());
+		for (size_t i = 0; i < pairs.size(); ++i)
+		{
+			pair_smaller[i] = pairs[i].sm_label;
+			pair_larger[i] = pairs[i].lg_label;
+			pair_areas[i] = pairs[i].surface_area;
+			pair_curvatures[i] = pairs[i].sm_curvature;
+		}
 
-		afile.close();
+		std::vector<uint32_t> velocity_smaller(velocities.size()), velocity_larger(velocities.size());
+		std::vector<int32_t> velocity_values(velocities.size());
+		for (size_t i = 0; i < velocities.size(); ++i)
+		{
+			velocity_smaller[i] = velocities[i].sm_label;
+			velocity_larger[i] = velocities[i].lg_label;
+			velocity_values[i] = velocities[i].delta;
+		}
+
+		std::vector<uint32_t> boundary_a, boundary_b, junction_a, junction_b;
+		std::vector<uint64_t> junction_ends;
+		size_t begin = 0;
+		for (auto end_iter = adjacency_ends.begin(); end_iter != adjacency_ends.end(); ++end_iter)
+		{
+			boundary_a.push_back(adjacency_labels[begin]);
+			boundary_b.push_back(adjacency_labels[begin + 1]);
+			for (size_t i = begin + 2; i < *end_iter; i += 2)
+			{
+				junction_a.push_back(adjacency_labels[i]);
+				junction_b.push_back(adjacency_labels[i + 1]);
+			}
+			junction_ends.push_back(junction_a.size());
+			begin = *end_iter;
+		}
+
+		analysis_archive_t::column_data_t columns[analysis_archive_t::COLUMN_COUNT];
+		columns[analysis_archive_t::VOLUME_GRAIN].set(volume_grains);
+		columns[analysis_archive_t::VOLUME].set(volume_values);
+		columns[analysis_archive_t::PAIR_SMALLER].set(pair_smaller);
+		columns[analysis_archive_t::PAIR_LARGER].set(pair_larger);
+		columns[analysis_archive_t::PAIR_AREA].set(pair_areas);
+		columns[analysis_archive_t::PAIR_CURVATURE].set(pair_curvatures);
+		columns[analysis_archive_t::VELOCITY_SMALLER].set(velocity_smaller);
+		columns[analysis_archive_t::VELOCITY_LARGER].set(velocity_larger);
+		columns[analysis_archive_t::VELOCITY].set(velocity_values);
+		columns[analysis_archive_t::BOUNDARY_A].set(boundary_a);
+		columns[analysis_archive_t::BOUNDARY_B].set(boundary_b);
+		columns[analysis_archive_t::JUNCTION_END].set(junction_ends);
+		columns[analysis_archive_t::JUNCTION_A].set(junction_a);
+		columns[analysis_archive_t::JUNCTION_B].set(junction_b);
+		archive->append(timestep, columns);
 	}
 };
\ No newline at end of file
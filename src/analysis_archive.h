@@ -0,0 +1,170 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <vector>
+
+#include "restart_io.h"
+
+/*
+
+A binary, columnar time series of analysis data (.gsa), with one block appended per checkpoint. All values are in the native byte order.
+
+	char[8]		magic ("GRAINAN1")
+	uint32		version (1)
+	uint32		the number of columns in each block
+	...			blocks
+
+	block
+		uint64		block size (in bytes, including this header)
+		double		timestep
+		(uint64 offset, uint64 count)[column count]		the offset of each column (relative to the start of the block) and its number of values
+		...			the columns, each starting at an 8-byte boundary
+
+The columns of every block, in order (the pairs are stored once, with the smaller grain ID first):
+
+	0	VOLUME_GRAIN		uint32		the grain IDs of the live grains
+	1	VOLUME				uint64		their volumes
+	2	PAIR_SMALLER		uint32		the grain pairs that share a surface
+	3	PAIR_LARGER			uint32
+	4	PAIR_AREA			int32		their surface areas
+	5	PAIR_CURVATURE		float64		their curvatures, seen from the smaller grain (the larger grain sees the negative)
+	6	VELOCITY_SMALLER	uint32		the grain pairs whose boundary has moved since the last checkpoint
+	7	VELOCITY_LARGER		uint32
+	8	VELOCITY			int32		the net number of voxels the smaller grain has gained from the larger one (the larger grain sees the negative)
+	9	BOUNDARY_A			uint32		the grain pairs of the boundaries
+	10	BOUNDARY_B			uint32
+	11	JUNCTION_END		uint64		the end of each boundary's junctions within the junction columns
+	12	JUNCTION_A			uint32		the grain pairs of the boundaries' junctions
+	13	JUNCTION_B			uint32
+
+An index file (<name>.idx) lists every block, so that a single column can be read across all checkpoints by seeking straight to it:
+
+	char[8]		magic ("GRAINAI1")
+	(double timestep, uint64 block offset)[]
+
+*/
+class analysis_archive_t
+{
+public:
+	static const char *magic()
+	{
+		return "GRAINAN1";
+	}
+	static const char *index_magic()
+	{
+		return "GRAINAI1";
+	}
+	static const uint32_t VERSION = 1;
+	static const size_t HEADER_SIZE = 16, INDEX_HEADER_SIZE = 8;
+
+	enum column_t : uint32_t
+	{
+		VOLUME_GRAIN, VOLUME,
+		PAIR_SMALLER, PAIR_LARGER, PAIR_AREA, PAIR_CURVATURE,
+		VELOCITY_SMALLER, VELOCITY_LARGER, VELOCITY,
+		BOUNDARY_A, BOUNDARY_B, JUNCTION_END, JUNCTION_A, JUNCTION_B,
+		COLUMN_COUNT
+	};
+
+	// The values of a single column of a block.
+	struct column_data_t
+	{
+		const void *data = nullptr;
+		size_t count = 0, value_size = 0;
+
+		template <typename T>
+		void set(const std::vector<T> &values)
+		{
+			data = values.data();
+			count = values.size();
+			value_size = sizeof(T);
+		}
+	};
+
+private:
+	std::ofstream data_file, index_file;
+	uint64_t data_size = 0, index_size = 0;
+
+public:
+	// Open the archive and its index. When resuming from a restart file, both are cut back to the sizes they had when the restart file
+	// was written and appended to.
+	void open(const std::string &path, long resume_data_offset = -1, long resume_index_offset = -1)
+	{
+		std::cout << "Writing binary analysis data to " << path << std::endl;
+
+		if (open_resumable_file(&data_file, path, resume_data_offset, std::ios::binary))
+		{
+			data_size = resume_data_offset;
+		}
+		else
+		{
+			uint32_t header[2] = { VERSION, COLUMN_COUNT };
+			data_file.write(magic(), 8);
+			data_file.write(reinterpret_cast<const char *>(header), sizeof(header));
+			data_size = HEADER_SIZE;
+		}
+
+		if (open_resumable_file(&index_file, path + ".idx", resume_index_offset, std::ios::binary))
+		{
+			index_size = resume_index_offset;
+		}
+		else
+		{
+			index_file.write(index_magic(), 8);
+			index_size = INDEX_HEADER_SIZE;
+		}
+	}
+
+	// Append a block of columns (there must be COLUMN_COUNT of them) and add it to the index.
+	void append(double timestep, const column_data_t *columns)
+	{
+		const size_t table_size = 16 + COLUMN_COUNT * 16;
+		std::vector<uint64_t> table(2 + COLUMN_COUNT * 2);
+		uint64_t offset = table_size;
+		for (size_t c = 0; c < COLUMN_COUNT; ++c)
+		{
+			table[2 + c * 2] = offset;
+			table[3 + c * 2] = columns[c].count;
+			offset += (columns[c].count * columns[c].value_size + 7) / 8 * 8;
+		}
+		table[0] = offset;
+		memcpy(&table[1], &timestep, sizeof(double));
+
+		const char padding[8] = {};
+		uint64_t block_offset = data_size;
+		data_file.write(reinterpret_cast<const char *>(table.data()), table_size);
+		for (size_t c = 0; c < COLUMN_COUNT; ++c)
+		{
+			size_t bytes = columns[c].count * columns[c].value_size;
+			data_file.write(static_cast<const char *>(columns[c].data), bytes);
+			data_file.write(padding, (8 - bytes % 8) % 8);
+		}
+		std::flush(data_file);
+		data_size += offset;
+
+		index_file.write(reinterpret_cast<const char *>(&timestep), sizeof(double));
+		index_file.write(reinterpret_cast<const char *>(&block_offset), sizeof(uint64_t));
+		std::flush(index_file);
+		index_size += 16;
+	}
+
+	// Get the sizes of the archive and its index (for restart files).
+	long data_offset() const
+	{
+		return data_size;
+	}
+	long index_offset() const
+	{
+		return index_size;
+	}
+
+	void close()
+	{
+		data_file.close();
+		index_file.close();
+	}
+};
\ No newline at end of file
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+
+#include "types.h"
+#include "restart_io.h"
+
+// Statistics for the boundary between a pair of grains (the "smaller" grain is the one with the smaller spin).
+struct pair_stats_t
+{
+	// The number of edge "outies" of the smaller grain into the larger grain, and vice versa.
+	int sm_to_lg_outies = 0,
+		lg_to_sm_outies = 0;
+	// The number of voxel faces shared by the two grains.
+	int surface_area = 0;
+};
+
+// Counts the voxel faces shared by each pair of grains, and the number of pairs that share at least one face (only the six faces of a
+// flipped voxel can change). This is the face_counts feature, which backs the pair count without the full analysis statistics.
+class face_tracker_t
+{
+public:
+	// Indexed by the smaller spin of each pair, then by the larger spin (pairs that no longer share a face are removed).
+	std::vector<std::unordered_map<spin_t, int> > face_counts;
+	// The number of pairs of grains that share at least one face.
+	size_t boundary_count = 0;
+
+	// Size the tracker for spins 1..spin_count and clear all counts.
+	void reset(spin_t spin_count)
+	{
+		face_counts.assign(spin_count + 1, std::unordered_map<spin_t, int>());
+		boundary_count = 0;
+	}
+
+	void save_state(restart_writer_t *out)
+	{
+		out->put<uint64_t>(face_counts.size());
+		for (auto sm_iter = face_counts.begin(); sm_iter != face_counts.end(); ++sm_iter)
+		{
+			out->put_unordered(*sm_iter, [out](const std::pair<const spin_t, int> &entry)
+			{
+				out->put(entry.first);
+				out->put(entry.second);
+			});
+		}
+		out->put<uint64_t>(boundary_count);
+	}
+	void load_state(restart_reader_t *in)
+	{
+		face_counts.assign(in->get<uint64_t>(), std::unordered_map<spin_t, int>());
+		for (auto sm_iter = face_counts.begin(); sm_iter != face_counts.end(); ++sm_iter)
+		{
+			in->get_unordered(&*sm_iter, [in]()
+			{
+				spin_t key = in->get<spin_t>();
+				return std::pair<const spin_t, int>(key, in->get<int>());
+			});
+		}
+		boundary_count = in->get<uint64_t>();
+	}
+
+	// Change the number of faces shared by two different grains.
+	void add_face(spin_t a, spin_t b, int delta)
+	{
+		std::unordered_map<spin_t, int> *sm_bucket = &face_counts[a < b ? a : b];
+		auto count_iter = sm_bucket->emplace(a < b ? b : a, 0).first;
+		if (count_iter->second == 0) ++boundary_count;
+		count_iter->second += delta;
+		if (count_iter->second == 0)
+		{
+			sm_bucket->erase(count_iter);
+			--boundary_count;
+		}
+	}
+
+	// Update the counts for a voxel flipping from one spin to another, given the spins of its six face neighbors.
+	void flip(const spin_t *face_spins, spin_t old_spin, spin_t new_spin)
+	{
+		for (char f = 0; f < 6; ++f)
+		{
+			if (face_spins[f] != old_spin) add_face(old_spin, face_spins[f], -1);
+			if (face_spins[f] != new_spin) add_face(new_spin, face_spins[f], 1);
+		}
+	}
+};
+
+// Keeps the per-boundary analysis statistics (surface areas and curvature outies) up to date as voxels flip.
+// A face is counted for every pair of face-adjacent voxels with different spins. An outie is counted for every 2x2 square of voxels
+// (in any of the three planes) where one voxel differs from the other three, which all share a spin.
+class analysis_tracker_t
+{
+private:
+	// The neighborhood indices of the six face neighbors of a voxel.
+	const char FACE_LOOKUP[6] = { 4, 10, 12, 14, 16, 22 };
+	// The neighborhood indices of the other three voxels within each of the twelve 2x2 squares that contain a voxel.
+	char SQUARE_LOOKUP[12][3];
+
+	pair_stats_t *get_stats(spin_t a, spin_t b)
+	{
+		return a < b ? &pair_stats[a][b] : &pair_stats[b][a];
+	}
+
+public:
+	// Indexed by the smaller spin of each pair, then by the larger spin.
+	std::vector<std::unordered_map<spin_t, pair_stats_t> > pair_stats;
+	// The number of pairs of grains that share at least one face.
+	size_t boundary_count = 0;
+
+	analysis_tracker_t()
+	{
+		char square = 0;
+		for (char sa = -1; sa <= 1; sa += 2)
+			for (char sb = -1; sb <= 1; sb += 2)
+			{
+				// XY, XZ and YZ planes.
+				SQUARE_LOOKUP[square][0] = neighborhood_index(sa, 0, 0);
+				SQUARE_LOOKUP[square][1] = neighborhood_index(0, sb, 0);
+				SQUARE_LOOKUP[square][2] = neighborhood_index(sa, sb, 0);
+				++square;
+				SQUARE_LOOKUP[square][0] = neighborhood_index(sa, 0, 0);
+				SQUARE_LOOKUP[square][1] = neighborhood_index(0, 0, sb);
+				SQUARE_LOOKUP[square][2] = neighborhood_index(sa, 0, sb);
+				++square;
+				SQUARE_LOOKUP[square][0] = neighborhood_index(0, sa, 0);
+				SQUARE_LOOKUP[square][1] = neighborhood_index(0, 0, sb);
+				SQUARE_LOOKUP[square][2] = neighborhood_index(0, sa, sb);
+				++square;
+			}
+	}
+
+	// Get the index of an offset (-1..1 on each axis) within a 3x3x3 neighborhood (the center is index 13).
+	static char neighborhood_index(char dx, char dy, char dz)
+	{
+		return (dx + 1) + (dy + 1) * 3 + (dz + 1) * 9;
+	}
+
+	// Size the tracker for spins 1..spin_count and clear all statistics.
+	void reset(spin_t spin_count)
+	{
+		pair_stats.assign(spin_count + 1, std::unordered_map<spin_t, pair_stats_t>());
+		boundary_count = 0;
+	}
+
+	void save_state(restart_writer_t *out)
+	{
+		out->put<uint64_t>(pair_stats.size());
+		for (auto sm_iter = pair_stats.begin(); sm_iter != pair_stats.end(); ++sm_iter)
+		{
+			out->put_unordered(*sm_iter, [out](const std::pair<const spin_t, pair_stats_t> &entry)
+			{
+				out->put(entry.first);
+				out->put(entry.second);
+			});
+		}
+		out->put<uint64_t>(boundary_count);
+	}
+	void load_state(restart_reader_t *in)
+	{
+		pair_stats.assign(in->get<uint64_t>(), std::unordered_map<spin_t, pair_stats_t>());
+		for (auto sm_iter = pair_stats.begin(); sm_iter != pair_stats.end(); ++sm_iter)
+		{
+			in->get_unordered(&*sm_iter, [in]()
+			{
+				spin_t key = in->get<spin_t>();
+				return std::pair<const spin_t, pair_stats_t>(key, in->get<pair_stats_t>());
+			});
+		}
+		boundary_count = in->get<uint64_t>();
+	}
+
+	// Change the number of faces shared by two different grains.
+	void add_face(spin_t a, spin_t b, int delta)
+	{
+		int *surface_area = &get_stats(a, b)->surface_area;
+		if (*surface_area == 0) ++boundary_count;
+		*surface_area += delta;
+		if (*surface_area == 0) --boundary_count;
+	}
+
+	// Change the number of squares where a single voxel of one grain pokes into three voxels of another.
+	void add_outie(spin_t outer, spin_t inner, int delta)
+	{
+		if (outer < inner)
+		{
+			pair_stats[outer][inner].sm_to_lg_outies += delta;
+		}
+		else
+		{
+			pair_stats[inner][outer].lg_to_sm_outies += delta;
+		}
+	}
+
+	// Count a 2x2 square of voxels if it contains an outie (the spins can be given in any order).
+	void add_square(spin_t s0, spin_t s1, spin_t s2, spin_t s3, int delta)
+	{
+		if (s0 != s1 && s1 == s2 && s1 == s3)
+		{
+			add_outie(s0, s1, delta);
+		}
+		else if (s1 != s0 && s0 == s2 && s0 == s3)
+		{
+			add_outie(s1, s0, delta);
+		}
+		else if (s2 != s0 && s0 == s1 && s0 == s3)
+		{
+			add_outie(s2, s0, delta);
+		}
+		else if (s3 != s0 && s0 == s1 && s0 == s2)
+		{
+			add_outie(s3, s0, delta);
+		}
+	}
+
+	// Update the statistics for the center voxel of a 3x3x3 neighborhood of spins flipping from one spin to another.
+	// Only the six faces and twelve squares that contain the voxel can change.
+	void flip(const spin_t *neighborhood, spin_t old_spin, spin_t new_spin)
+	{
+		for (char f = 0; f < 6; ++f)
+		{
+			spin_t nspin = neighborhood[FACE_LOOKUP[f]];
+			if (nspin != old_spin) add_face(old_spin, nspin, -1);
+			if (nspin != new_spin) add_face(new_spin, nspin, 1);
+		}
+
+		for (char q = 0; q < 12; ++q)
+		{
+			spin_t
+				s1 = neighborhood[SQUARE_LOOKUP[q][0]],
+				s2 = neighborhood[SQUARE_LOOKUP[q][1]],
+				s3 = neighborhood[SQUARE_LOOKUP[q][2]];
+
+			// A square where the other three voxels all differ can never hold an outie.
+			if (s1 != s2 && s1 != s3 && s2 != s3) continue;
+
+			add_square(old_spin, s1, s2, s3, -1);
+			add_square(new_spin, s1, s2, s3, 1);
+		}
+	}
+};
\ No newline at end of file
@@ -2,10 +2,27 @@
 
 #include <unordered_map>
 #include <unordered_set>
-#include <list>
+#include <vector>
+#include <iostream>
 
 #include "types.h"
 #include "config.h"
+#include "pool.h"
+#include "restart_io.h"
+
+struct boundary_t;
+
+// Hashes a boundary by its spin pair rather than its address, so that the iteration order of junction maps does not depend on where
+// the boundaries happen to be allocated (which keeps runs reproducible, and allows restart files to restore that order).
+struct boundary_hash_t
+{
+	size_t operator()(const boundary_t *boundary) const;
+};
+
+// Per-boundary containers draw their nodes from shared block pools to avoid allocator churn.
+typedef std::unordered_set<size_t, std::hash<size_t>, std::equal_to<size_t>, pool_allocator_t<size_t> > voxel_index_set_t;
+typedef std::unordered_map<boundary_t *, long, boundary_hash_t, std::equal_to<boundary_t *>, pool_allocator_t<std::pair<boundary_t *const, long> > > junction_map_t;
+typedef std::unordered_set<boundary_t *, boundary_hash_t, std::equal_to<boundary_t *>, pool_allocator_t<boundary_t *> > boundary_set_t;
 
 #pragma pack(push, 1)
 struct boundary_t
@@ -13,22 +30,23 @@ struct boundary_t
 	spin_t a_spin, b_spin;
 
 	bool transformed = false;
-	std::unordered_set<size_t> boundary_voxel_indices;
+	// The complexion class of this boundary (indexes the lattice's dense mobility, energy and probability tables).
+	unsigned char boundary_class = 0;
+	voxel_index_set_t boundary_voxel_indices;
 
 	// Sweeping mechanism.
 	size_t previous_surface_area = 0;
 	int potential_energy = 0;
 
 	// Stores the adjacent boundaries and the number of voxels that they share.
-	std::unordered_map<boundary_t *, long> junctions;
-	void incr_junction(boundary_t *b)
-	{
-		junctions[b] += 1;
-	}
-	void decr_junction(boundary_t *b)
-	{
-		junctions[b] -= 1;
-	}
+	junction_map_t junctions;
+	// Stores the boundaries whose junction maps reference this boundary (so that they can be unlinked when it is deleted).
+	boundary_set_t junction_referrers;
+
+	// Whether or not this boundary is currently waiting within the tracker's retirement queue.
+	bool retirement_queued = false;
+	// The position of this boundary within the tracker's transformed or untransformed pool.
+	size_t pool_index = 0;
 
 	size_t area()
 	{
@@ -37,28 +55,128 @@ struct boundary_t
 };
 #pragma pack(pop)
 
+inline size_t boundary_hash_t::operator()(const boundary_t *boundary) const
+{
+	return std::hash<uint64_t>()(((uint64_t)boundary->a_spin << 32) | boundary->b_spin);
+}
+
 struct boundary_tracker_t
 {
-	// The boundary map is actually a map of maps. When trying to find the boundary object for
-	// the boundary between two grains, the root map takes the smaller spin of the two as the key,
+	// The boundary map is actually an array of maps. When trying to find the boundary object for
+	// the boundary between two grains, the array is indexed by the smaller spin of the two,
 	// and the child map takes the larger spin of the two as the key. (e.g. if trying to find the boundary
-	// between grains 5 and 10, we would do it via "boundary_map.at(5).at(10)" ). This ordering prevents
-	// redundancies.
+	// between grains 5 and 10, we would do it via "boundary_map[5].at(10)" ). This ordering prevents
+	// redundancies. Spins are dense (see lattice_t::compact_spins()), so the array is sized by resize().
 
-	std::unordered_map<spin_t, std::unordered_map<spin_t, boundary_t *> > boundary_map;
+	std::vector<std::unordered_map<spin_t, boundary_t *> > boundary_map;
 	size_t transformed_boundary_count = 0, total_boundary_count = 0;
 
+	// The minimum size that the dead junction queue can reach before it is flushed outside of a regular cleanup.
+	static const size_t MAX_DEAD_JUNCTION_QUEUE = 1 << 20;
+
+	// Boundaries whose area has dropped to zero (or that were created without any area) since the last cleanup.
+	// Boundaries may regain area before the cleanup happens, so the area is checked again before deletion.
+	std::vector<boundary_t *> retirement_queue;
+	// Junctions (owner, adjacent boundary) whose shared voxel count has dropped to zero or below since the last cleanup.
+	std::vector<std::pair<boundary_t *, boundary_t *> > dead_junction_queue;
+
+	// The pool that all boundary objects are allocated from.
+	object_pool_t<boundary_t> boundary_pool;
+
+	// Indexable pools of all transformed and untransformed boundaries (allows for constant-time random selection).
+	// Order within a pool is meaningless; removal swaps the last boundary into the vacated slot.
+	std::vector<boundary_t *> transformed_pool, untransformed_pool;
+
+private:
+	// Append a boundary to a pool.
+	void pool_insert(std::vector<boundary_t *> *pool, boundary_t *boundary)
+	{
+		boundary->pool_index = pool->size();
+		pool->push_back(boundary);
+	}
+	// Remove a boundary from a pool by swapping the last boundary into its slot.
+	void pool_remove(std::vector<boundary_t *> *pool, boundary_t *boundary)
+	{
+		boundary_t *last = pool->back();
+		(*pool)[boundary->pool_index] = last;
+		last->pool_index = boundary->pool_index;
+		pool->pop_back();
+	}
+
+	// Queue a boundary for deletion during the next cleanup (if it is not already queued).
+	void queue_retirement(boundary_t *boundary)
+	{
+		if (boundary->retirement_queued) return;
+
+		boundary->retirement_queued = true;
+		retirement_queue.push_back(boundary);
+	}
+
+	// Increment the number of voxels that a boundary shares with an adjacent boundary.
+	void incr_junction(boundary_t *boundary, boundary_t *jbound)
+	{
+		auto junc_iter = boundary->junctions.find(jbound);
+		if (junc_iter == boundary->junctions.end())
+		{
+			boundary->junctions.emplace(jbound, 1);
+			jbound->junction_referrers.insert(boundary);
+		}
+		else
+		{
+			++junc_iter->second;
+		}
+	}
+	// Decrement the number of voxels that a boundary shares with an adjacent boundary (queues the junction for removal once it reaches zero).
+	void decr_junction(boundary_t *boundary, boundary_t *jbound)
+	{
+		auto junc_iter = boundary->junctions.find(jbound);
+		if (junc_iter == boundary->junctions.end())
+		{
+			boundary->junctions.emplace(jbound, -1);
+			jbound->junction_referrers.insert(boundary);
+			dead_junction_queue.emplace_back(boundary, jbound);
+		}
+		else if (--junc_iter->second == 0)
+		{
+			dead_junction_queue.emplace_back(boundary, jbound);
+		}
+
+		// The junction queue is not deduplicated, so keep it from growing without bound when cleanups are rare (e.g. no transitions).
+		if (dead_junction_queue.size() >= MAX_DEAD_JUNCTION_QUEUE && dead_junction_queue.size() >= total_boundary_count * 4)
+		{
+			remove_dead_junctions();
+		}
+	}
+
+	// Remove a junction from a boundary (along with the matching back-reference).
+	void unlink_junction(boundary_t *boundary, boundary_t *jbound)
+	{
+		boundary->junctions.erase(jbound);
+		jbound->junction_referrers.erase(boundary);
+	}
+
+public:
+	// Size the per-grain tables for spins 1..spin_count (must be called before any boundaries are created).
+	void resize(spin_t spin_count)
+	{
+		boundary_map.resize(spin_count + 1);
+		velocity_tracker.resize(spin_count + 1);
+	}
+
 	// Find the boundary between two grains, or create it if it does not yet exist.
 	boundary_t *find_or_create_boundary(spin_t a, spin_t b)
 	{
-		boundary_t *output = boundary_map[a < b ? a : b][a < b ? b : a];
+		boundary_t *&output = boundary_map[a < b ? a : b][a < b ? b : a];
 		if (!output)
 		{
-			output = new boundary_t();
+			output = boundary_pool.create();
 			output->a_spin = a;
 			output->b_spin = b;
-			boundary_map[a < b ? a : b][a < b ? b : a] = output;
+			pool_insert(&untransformed_pool, output);
 			++total_boundary_count;
+
+			// New boundaries start out without any area, so they must be checked during the next cleanup.
+			queue_retirement(output);
 		}
 		return output;
 	}
@@ -66,46 +184,85 @@ struct boundary_tracker_t
 	// Forcefully delete the boundary between two grains.
 	void delete_boundary(spin_t a, spin_t b)
 	{
-		std::unordered_map<spin_t, boundary_t *> *sm_bucket = &boundary_map.at(a < b ? a : b);
+		std::unordered_map<spin_t, boundary_t *> *sm_bucket = &boundary_map[a < b ? a : b];
 
 		boundary_t *boundary = sm_bucket->at(a < b ? b : a);
 		sm_bucket->erase(a < b ? b : a);
 
 		if (boundary->transformed)
 		{
+			pool_remove(&transformed_pool, boundary);
 			--transformed_boundary_count;
 		}
-		if (sm_bucket->size() == 0)
+		else
 		{
-			boundary_map.erase(a < b ? a : b);
+			pool_remove(&untransformed_pool, boundary);
 		}
-
 		--total_boundary_count;
 
 		// just give potential energy to a random boundary...
-		if (boundary->junctions.size() > 0)
+		boundary_t *transfer_boundary = nullptr;
+		for (auto junc_iter = boundary->junctions.begin(); junc_iter != boundary->junctions.end(); ++junc_iter)
 		{
-			boundary_t *transfer_boundary = nullptr;
-			for (auto junc_iter = boundary->junctions.begin(); junc_iter != boundary->junctions.end(); ++junc_iter)
+			if (junc_iter->first->area() == 0) continue;
+
+			if (junc_iter->first->transformed)
 			{
-				if (junc_iter->first->transformed)
+				if (junc_iter->first->potential_energy > 0)
 				{
-					if (junc_iter->first->potential_energy > 0)
-					{
-						transfer_boundary = junc_iter->first;
-						break;
-					}
-					else if (transfer_boundary == nullptr)
-					{
-						transfer_boundary = junc_iter->first;
-					}
+					transfer_boundary = junc_iter->first;
+					break;
 				}
+				else if (transfer_boundary == nullptr || !transfer_boundary->transformed)
+				{
+					transfer_boundary = junc_iter->first;
+				}
+			}
+			else if (transfer_boundary == nullptr)
+			{
+				transfer_boundary = junc_iter->first;
 			}
-			if (transfer_boundary == nullptr) transfer_boundary = boundary->junctions.begin()->first;
-			transfer_boundary->potential_energy += boundary->potential_energy;
+		}
+		if (transfer_boundary != nullptr) transfer_boundary->potential_energy += boundary->potential_energy;
+
+		// Unlink the boundary from every junction map that references it (and vice versa).
+		for (auto ref_iter = boundary->junction_referrers.begin(); ref_iter != boundary->junction_referrers.end(); ++ref_iter)
+		{
+			(*ref_iter)->junctions.erase(boundary);
+		}
+		for (auto junc_iter = boundary->junctions.begin(); junc_iter != boundary->junctions.end(); ++junc_iter)
+		{
+			junc_iter->first->junction_referrers.erase(boundary);
 		}
 
-		delete boundary;
+		boundary_pool.destroy(boundary);
+	}
+
+	// Print the usage of the boundary pool and the shared pools that back the per-boundary containers.
+	void print_pool_stats()
+	{
+		const pool_stats_t &stats = boundary_pool.get_stats();
+		std::cout << "Boundary pool: " << stats.live << " live, " << stats.high_water << " high-water, " << stats.capacity << " capacity";
+
+		std::vector<block_pool_t *> &pools = shared_block_pools();
+		for (auto pool_iter = pools.begin(); pool_iter != pools.end(); ++pool_iter)
+		{
+			const pool_stats_t &node_stats = (*pool_iter)->get_stats();
+			std::cout << "; " << (*pool_iter)->get_block_size() << "B nodes: " << node_stats.live << " live, " << node_stats.high_water << " high-water";
+		}
+		std::cout << std::endl;
+	}
+
+	~boundary_tracker_t()
+	{
+		for (auto pool_iter = transformed_pool.begin(); pool_iter != transformed_pool.end(); ++pool_iter)
+		{
+			boundary_pool.destroy(*pool_iter);
+		}
+		for (auto pool_iter = untransformed_pool.begin(); pool_iter != untransformed_pool.end(); ++pool_iter)
+		{
+			boundary_pool.destroy(*pool_iter);
+		}
 	}
 
 	// Check if the boundary between two grains is transformed.
@@ -114,31 +271,39 @@ struct boundary_tracker_t
 		return find_or_create_boundary(a, b)->transformed;
 	}
 
-	// Add a voxel to a boundary and update that boundary's junctions.
+	// Add a voxel to a boundary and update that boundary's junctions (if enabled).
+	template <bool JUNCTIONS = true>
 	void add_to_boundary(spin_t a, spin_t b, size_t index, spin_t *voxel_neighbor_spins)
 	{
 		boundary_t *boundary = find_or_create_boundary(a, b);
 		boundary->boundary_voxel_indices.insert(index);
+		if (!JUNCTIONS) return;
 
 		for (char i = 0; i < NEIGH_COUNT; ++i)
 		{
 			if (voxel_neighbor_spins[i] != 0 && voxel_neighbor_spins[i] != a && voxel_neighbor_spins[i] != b)
 			{
-				boundary->incr_junction(find_or_create_boundary(a, voxel_neighbor_spins[i])); // assume that spin "a" is the root voxel
+				incr_junction(boundary, find_or_create_boundary(a, voxel_neighbor_spins[i])); // assume that spin "a" is the root voxel
 			}
 		}
 	}
-	// Remove a voxel from a boundary and update that boundary's junctions.
+	// Remove a voxel from a boundary and update that boundary's junctions (if enabled).
+	template <bool JUNCTIONS = true>
 	void remove_from_boundary(spin_t a, spin_t b, size_t index, spin_t *voxel_neighbor_spins)
 	{
 		boundary_t *boundary = find_or_create_boundary(a, b);
 		boundary->boundary_voxel_indices.erase(index);
+		if (boundary->area() == 0)
+		{
+			queue_retirement(boundary);
+		}
+		if (!JUNCTIONS) return;
 
 		for (char i = 0; i < NEIGH_COUNT; ++i)
 		{
 			if (voxel_neighbor_spins[i] != 0 && voxel_neighbor_spins[i] != a && voxel_neighbor_spins[i] != b)
 			{
-				boundary->decr_junction(find_or_create_boundary(a, voxel_neighbor_spins[i])); // assume that spin "a" is the root grain
+				decr_junction(boundary, find_or_create_boundary(a, voxel_neighbor_spins[i])); // assume that spin "a" is the root grain
 			}
 		}
 	}
@@ -149,53 +314,201 @@ struct boundary_tracker_t
 		if (boundary->transformed) return;
 
 		boundary->transformed = true;
+		pool_remove(&untransformed_pool, boundary);
+		pool_insert(&transformed_pool, boundary);
 		++transformed_boundary_count;
 	}
 
+	// Swap two boundaries within the transformed pool (used to draw boundaries without replacement).
+	void swap_transformed(size_t i, size_t j)
+	{
+		std::swap(transformed_pool[i], transformed_pool[j]);
+		transformed_pool[i]->pool_index = i;
+		transformed_pool[j]->pool_index = j;
+	}
+
+	// Remove all queued junctions that no longer share any voxels.
+	void remove_dead_junctions()
+	{
+		for (auto dead_iter = dead_junction_queue.begin(); dead_iter != dead_junction_queue.end(); ++dead_iter)
+		{
+			auto junc_iter = dead_iter->first->junctions.find(dead_iter->second);
+			if (junc_iter != dead_iter->first->junctions.end() && junc_iter->second <= 0)
+			{
+				unlink_junction(dead_iter->first, dead_iter->second);
+			}
+		}
+		dead_junction_queue.clear();
+	}
+
 	// Delete all invalid boundaries from the boundary map and remove all invalid junctions.
+	// Only boundaries and junctions that were queued since the last call are visited, so the cost is proportional to the number that died.
 	void remove_bad_boundaries()
 	{
-		std::list<boundary_t *> delete_list;
+		// Junctions are handled first, since deleting a boundary unlinks it from every junction map anyway.
+		remove_dead_junctions();
+
+		// Clear the queue (and every queued flag) before deleting anything.
+		std::vector<boundary_t *> delete_list;
+		delete_list.swap(retirement_queue);
+		for (auto delete_iter = delete_list.begin(); delete_iter != delete_list.end(); ++delete_iter)
+		{
+			(*delete_iter)->retirement_queued = false;
+		}
+		for (auto delete_iter = delete_list.begin(); delete_iter != delete_list.end(); ++delete_iter)
+		{
+			if ((*delete_iter)->area() == 0)
+			{
+				delete_boundary((*delete_iter)->a_spin, (*delete_iter)->b_spin);
+			}
+		}
+	}
+
+	// Write every boundary (with its voxels and junctions), the pools and queues, and the velocity tracker to a restart file.
+	// Boundaries are referred to by their spin pair, since their addresses change when they are read back.
+	void save_state(restart_writer_t *out)
+	{
+		out->put<uint64_t>(boundary_map.size());
+		out->put<uint64_t>(transformed_boundary_count);
+		out->put<uint64_t>(total_boundary_count);
+
+		auto put_pair = [out](const boundary_t *boundary)
+		{
+			out->put(boundary->a_spin);
+			out->put(boundary->b_spin);
+		};
 
 		for (auto sm_iter = boundary_map.begin(); sm_iter != boundary_map.end(); ++sm_iter)
 		{
-			for (auto lg_iter = sm_iter->second.begin(); lg_iter != sm_iter->second.end(); ++lg_iter)
+			out->put_unordered(*sm_iter, [out](const std::pair<const spin_t, boundary_t *> &entry)
 			{
-				boundary_t *boundary = lg_iter->second;
-				if (boundary->area() == 0)
+				boundary_t *boundary = entry.second;
+				out->put(entry.first);
+				out->put(boundary->a_spin);
+				out->put(boundary->b_spin);
+				out->put(boundary->transformed);
+				out->put(boundary->boundary_class);
+				out->put<uint64_t>(boundary->previous_surface_area);
+				out->put(boundary->potential_energy);
+				out->put(boundary->retirement_queued);
+				out->put_unordered(boundary->boundary_voxel_indices, [out](size_t index) { out->put<uint64_t>(index); });
+			});
+		}
+		// Junctions can only be resolved once every boundary exists.
+		for (auto sm_iter = boundary_map.begin(); sm_iter != boundary_map.end(); ++sm_iter)
+			for (auto lg_iter = sm_iter->begin(); lg_iter != sm_iter->end(); ++lg_iter)
+			{
+				out->put_unordered(lg_iter->second->junctions, [out, &put_pair](const std::pair<boundary_t *const, long> &junction)
 				{
-					delete_list.push_back(boundary);
-				}
+					put_pair(junction.first);
+					out->put<int64_t>(junction.second);
+				});
+			}
 
-				std::list<boundary_t *> remove_from_junctions_list;
-				for (auto junc_iter = boundary->junctions.begin(); junc_iter != boundary->junctions.end(); ++junc_iter)
-				{
-					boundary_t *jbound = junc_iter->first;
-					if (jbound->area() == 0 || junc_iter->second <= 0)
-					{
-						remove_from_junctions_list.push_back(jbound);
-					}
-				}
+		out->put<uint64_t>(transformed_pool.size());
+		for (auto pool_iter = transformed_pool.begin(); pool_iter != transformed_pool.end(); ++pool_iter) put_pair(*pool_iter);
+		out->put<uint64_t>(untransformed_pool.size());
+		for (auto pool_iter = untransformed_pool.begin(); pool_iter != untransformed_pool.end(); ++pool_iter) put_pair(*pool_iter);
+		out->put<uint64_t>(retirement_queue.size());
+		for (auto queue_iter = retirement_queue.begin(); queue_iter != retirement_queue.end(); ++queue_iter) put_pair(*queue_iter);
+		out->put<uint64_t>(dead_junction_queue.size());
+		for (auto queue_iter = dead_junction_queue.begin(); queue_iter != dead_junction_queue.end(); ++queue_iter)
+		{
+			put_pair(queue_iter->first);
+			put_pair(queue_iter->second);
+		}
 
-				for (auto rm_junc_iter = remove_from_junctions_list.begin(); rm_junc_iter != remove_from_junctions_list.end(); ++rm_junc_iter)
+		for (auto sm_iter = velocity_tracker.begin(); sm_iter != velocity_tracker.end(); ++sm_iter)
+		{
+			out->put_unordered(*sm_iter, [out](const std::pair<const spin_t, std::pair<int, int> > &entry)
+			{
+				out->put(entry.first);
+				out->put(entry.second.first);
+				out->put(entry.second.second);
+			});
+		}
+	}
+
+	// Read the state written by save_state() (the tracker must be empty).
+	void load_state(restart_reader_t *in)
+	{
+		size_t map_size = in->get<uint64_t>();
+		boundary_map.assign(map_size, std::unordered_map<spin_t, boundary_t *>());
+		velocity_tracker.assign(map_size, std::unordered_map<spin_t, std::pair<int, int> >());
+		transformed_boundary_count = in->get<uint64_t>();
+		total_boundary_count = in->get<uint64_t>();
+
+		auto get_pair = [this, in]()
+		{
+			spin_t a = in->get<spin_t>(), b = in->get<spin_t>();
+			return boundary_map[a < b ? a : b].at(a < b ? b : a);
+		};
+
+		for (auto sm_iter = boundary_map.begin(); sm_iter != boundary_map.end(); ++sm_iter)
+		{
+			in->get_unordered(&*sm_iter, [this, in]()
+			{
+				spin_t key = in->get<spin_t>();
+				boundary_t *boundary = boundary_pool.create();
+				boundary->a_spin = in->get<spin_t>();
+				boundary->b_spin = in->get<spin_t>();
+				boundary->transformed = in->get<bool>();
+				boundary->boundary_class = in->get<unsigned char>();
+				boundary->previous_surface_area = in->get<uint64_t>();
+				boundary->potential_energy = in->get<int>();
+				boundary->retirement_queued = in->get<bool>();
+				in->get_unordered(&boundary->boundary_voxel_indices, [in]() { return (size_t)in->get<uint64_t>(); });
+				return std::pair<const spin_t, boundary_t *>(key, boundary);
+			});
+		}
+		for (auto sm_iter = boundary_map.begin(); sm_iter != boundary_map.end(); ++sm_iter)
+			for (auto lg_iter = sm_iter->begin(); lg_iter != sm_iter->end(); ++lg_iter)
+			{
+				boundary_t *boundary = lg_iter->second;
+				in->get_unordered(&boundary->junctions, [in, &get_pair]()
 				{
-					boundary->junctions.erase(*rm_junc_iter);
+					boundary_t *jbound = get_pair();
+					return std::pair<boundary_t *const, long>(jbound, in->get<int64_t>());
+				});
+				for (auto junc_iter = boundary->junctions.begin(); junc_iter != boundary->junctions.end(); ++junc_iter)
+				{
+					junc_iter->first->junction_referrers.insert(boundary);
 				}
 			}
+
+		transformed_pool.resize(in->get<uint64_t>());
+		for (size_t i = 0; i < transformed_pool.size(); ++i) (transformed_pool[i] = get_pair())->pool_index = i;
+		untransformed_pool.resize(in->get<uint64_t>());
+		for (size_t i = 0; i < untransformed_pool.size(); ++i) (untransformed_pool[i] = get_pair())->pool_index = i;
+		retirement_queue.resize(in->get<uint64_t>());
+		for (size_t i = 0; i < retirement_queue.size(); ++i) retirement_queue[i] = get_pair();
+		dead_junction_queue.resize(in->get<uint64_t>());
+		for (size_t i = 0; i < dead_junction_queue.size(); ++i)
+		{
+			boundary_t *owner = get_pair();
+			dead_junction_queue[i] = std::make_pair(owner, get_pair());
 		}
 
-		for (auto delete_iter = delete_list.begin(); delete_iter != delete_list.end(); ++delete_iter)
+		for (auto sm_iter = velocity_tracker.begin(); sm_iter != velocity_tracker.end(); ++sm_iter)
 		{
-			delete_boundary((*delete_iter)->a_spin, (*delete_iter)->b_spin);
+			in->get_unordered(&*sm_iter, [in]()
+			{
+				spin_t key = in->get<spin_t>();
+				int sm_to_lg = in->get<int>(), lg_to_sm = in->get<int>();
+				return std::pair<const spin_t, std::pair<int, int> >(key, std::make_pair(sm_to_lg, lg_to_sm));
+			});
 		}
 	}
 
 	// Velocity tracking.
-	std::unordered_map<spin_t, std::unordered_map<spin_t, std::pair<int, int> > > velocity_tracker;
-	// dict( small_spin, dict( large_spin, { sm->lg, lg->sm } ) )
+	std::vector<std::unordered_map<spin_t, std::pair<int, int> > > velocity_tracker;
+	// array( small_spin, dict( large_spin, { sm->lg, lg->sm } ) )
 	void reset_flip_tracker()
 	{
-		velocity_tracker.clear();
+		for (auto sm_iter = velocity_tracker.begin(); sm_iter != velocity_tracker.end(); ++sm_iter)
+		{
+			sm_iter->clear();
+		}
 	}
 	void track_flip(spin_t old_spin, spin_t new_spin)
 	{
@@ -16,8 +16,12 @@ struct config_t
 	double checkpoint_interval = -1;
 	double max_timestep = -1;
 	activ_t default_mobility = 0.002, transitioned_mobility = 0.04;
+	std::string class_mobilities, class_energies;
+	int transitioned_class = 1;
+	activ_t kT = 0.5;
 	double transition_interval = 0;
 	size_t transition_count = 0;
+	size_t transition_step_budget = 0;
 	double scale_multiplier = 1;
 	double propagation_chance = 0.95;
 	bool use_potential_energy = false;
@@ -25,6 +29,41 @@ struct config_t
 	bool log_transitions = false;
 	double propagation_ratio = 0;
 	bool generate_analysis_files = false;
+	std::string analysis_format = "text";
+	double telemetry_interval = 0;
+	int stop_grain_count = 0;
+	double stop_mean_grain_volume = 0;
+	double stop_activity = 0;
+	double stop_stall_window = 0, stop_stall_tolerance = 0;
+	double stop_check_interval = 1000;
+	std::string huge_pages = "none", numa_policy = "default";
+	std::string output_format = "ascii";
+	size_t snapshot_keyframe_interval = 10;
+	int snapshot_brick_size = 32;
+	unsigned output_threads = 2;
+	size_t output_queue_size = 4;
+	bool record_trajectory = false;
+	std::string live_export_name;
+	double live_export_interval = 10000;
+	double roi_interval = 0, downsample_interval = 0, slice_interval = 0;
+	std::string roi_origin = "0 0 0";
+	int roi_size = 32, downsample_factor = 4, slice_index = -1;
+	std::string downsample_mode = "stride", slice_axes = "z", slice_format = "ppm";
+	double trajectory_keyframe_interval = 1000000;
+	int numa_node = 0;
+	int first_touch_threads = -1;
+	std::string resume_file, restart_file;
+
+	// Convert a space-separated list of numbers to a vector.
+	static void list_to_vector(const std::string &list, std::vector<double> *output_vector)
+	{
+		std::istringstream ss(list);
+		std::string word;
+		while (ss >> word)
+		{
+			output_vector->push_back(std::stod(word));
+		}
+	}
 
 	void checkpoints_to_vector(std::vector<double> *checkpoint_vector)
 	{
@@ -88,6 +127,22 @@ struct config_t
 			{
 				transitioned_mobility = std::stod(value);
 			}
+			else if (key == "BOUNDARY_CLASS_MOBILITIES")
+			{
+				class_mobilities = value;
+			}
+			else if (key == "BOUNDARY_CLASS_ENERGIES")
+			{
+				class_energies = value;
+			}
+			else if (key == "TRANSITIONED_CLASS")
+			{
+				transitioned_class = std::stoi(value);
+			}
+			else if (key == "KT")
+			{
+				kT = std::stod(value);
+			}
 			else if (key == "TRANSITION_INTERVAL")
 			{
 				transition_interval = std::stod(value);
@@ -96,6 +151,10 @@ struct config_t
 			{
 				transition_count = std::stoi(value);
 			}
+			else if (key == "TRANSITION_STEP_BUDGET")
+			{
+				transition_step_budget = std::stoul(value);
+			}
 			else if (key == "PROPAGATION_CHANCE")
 			{
 				propagation_chance = std::stod(value);
@@ -124,6 +183,138 @@ struct config_t
 			{
 				generate_analysis_files = value == "true";
 			}
+			else if (key == "ANALYSIS_FORMAT")
+			{
+				analysis_format = value;
+			}
+			else if (key == "TELEMETRY_INTERVAL")
+			{
+				telemetry_interval = std::stod(value);
+			}
+			else if (key == "STOP_GRAIN_COUNT")
+			{
+				stop_grain_count = std::stoi(value);
+			}
+			else if (key == "STOP_MEAN_GRAIN_VOLUME")
+			{
+				stop_mean_grain_volume = std::stod(value);
+			}
+			else if (key == "STOP_ACTIVITY")
+			{
+				stop_activity = std::stod(value);
+			}
+			else if (key == "STOP_TRANSFORMED_STALL_WINDOW")
+			{
+				stop_stall_window = std::stod(value);
+			}
+			else if (key == "STOP_TRANSFORMED_STALL_TOLERANCE")
+			{
+				stop_stall_tolerance = std::stod(value);
+			}
+			else if (key == "STOP_CHECK_INTERVAL")
+			{
+				stop_check_interval = std::stod(value);
+			}
+			else if (key == "OUTPUT_FORMAT")
+			{
+				output_format = value;
+			}
+			else if (key == "SNAPSHOT_KEYFRAME_INTERVAL")
+			{
+				snapshot_keyframe_interval = std::stoul(value);
+			}
+			else if (key == "SNAPSHOT_BRICK_SIZE")
+			{
+				snapshot_brick_size = std::stoi(value);
+			}
+			else if (key == "OUTPUT_THREADS")
+			{
+				output_threads = std::stoul(value);
+			}
+			else if (key == "OUTPUT_QUEUE_SIZE")
+			{
+				output_queue_size = std::stoul(value);
+			}
+			else if (key == "RECORD_TRAJECTORY")
+			{
+				record_trajectory = value == "true";
+			}
+			else if (key == "TRAJECTORY_KEYFRAME_INTERVAL")
+			{
+				trajectory_keyframe_interval = std::stod(value);
+			}
+			else if (key == "ROI_INTERVAL")
+			{
+				roi_interval = std::stod(value);
+			}
+			else if (key == "ROI_ORIGIN")
+			{
+				roi_origin = value;
+			}
+			else if (key == "ROI_SIZE")
+			{
+				roi_size = std::stoi(value);
+			}
+			else if (key == "DOWNSAMPLE_INTERVAL")
+			{
+				downsample_interval = std::stod(value);
+			}
+			else if (key == "DOWNSAMPLE_FACTOR")
+			{
+				downsample_factor = std::stoi(value);
+			}
+			else if (key == "DOWNSAMPLE_MODE")
+			{
+				downsample_mode = value;
+			}
+			else if (key == "SLICE_INTERVAL")
+			{
+				slice_interval = std::stod(value);
+			}
+			else if (key == "SLICE_AXES")
+			{
+				slice_axes = value;
+			}
+			else if (key == "SLICE_INDEX")
+			{
+				slice_index = std::stoi(value);
+			}
+			else if (key == "SLICE_FORMAT")
+			{
+				slice_format = value;
+			}
+			else if (key == "LIVE_EXPORT_NAME")
+			{
+				live_export_name = value;
+			}
+			else if (key == "LIVE_EXPORT_INTERVAL")
+			{
+				live_export_interval = std::stod(value);
+			}
+			else if (key == "HUGE_PAGES")
+			{
+				huge_pages = value;
+			}
+			else if (key == "NUMA_POLICY")
+			{
+				numa_policy = value;
+			}
+			else if (key == "NUMA_NODE")
+			{
+				numa_node = std::stoi(value);
+			}
+			else if (key == "FIRST_TOUCH_THREADS")
+			{
+				first_touch_threads = std::stoi(value);
+			}
+			else if (key == "RESUME_FILE")
+			{
+				resume_file = value;
+			}
+			else if (key == "RESTART_FILE")
+			{
+				restart_file = value;
+			}
 			else
 			{
 				std::cout << "Warning: Unknown config key \"" << key << "\"." << std::endl;
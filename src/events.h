@@ -0,0 +1,90 @@
+#pragma once
+
+#include <queue>
+#include <vector>
+#include <functional>
+#include <limits>
+
+#include "restart_io.h"
+
+// The kinds of events that can be scheduled (events that are due at the same time are dispatched in this order).
+enum event_kind_t : char
+{
+	EVENT_LOG,
+	EVENT_TELEMETRY,
+	EVENT_TRANSITION,
+	EVENT_CHECKPOINT,
+	EVENT_PERIODIC_CHECKPOINT,
+	EVENT_TRAJECTORY_KEYFRAME,
+	EVENT_ROI,
+	EVENT_DOWNSAMPLE,
+	EVENT_SLICE,
+	EVENT_LIVE_EXPORT,
+	EVENT_STOP_CHECK,
+	EVENT_MAX_TIMESTEP
+};
+
+// An event that is due at a certain timestep.
+struct event_t
+{
+	double time;
+	event_kind_t kind;
+
+	bool operator>(const event_t &other) const
+	{
+		if (time != other.time) return time > other.time;
+		return kind > other.kind;
+	}
+};
+
+// A queue of scheduled events, ordered by the timestep at which they are due.
+class event_queue_t
+{
+private:
+	std::priority_queue<event_t, std::vector<event_t>, std::greater<event_t> > queue;
+
+public:
+	// Schedule an event.
+	void schedule(double time, event_kind_t kind)
+	{
+		queue.push({ time, kind });
+	}
+
+	// Check whether an event of a kind is scheduled (this copies the queue, so it is only meant for setting up a run).
+	bool has(event_kind_t kind)
+	{
+		for (auto pending = queue; !pending.empty(); pending.pop())
+		{
+			if (pending.top().kind == kind) return true;
+		}
+		return false;
+	}
+
+	// Get the timestep of the next event (infinity if nothing is scheduled).
+	double next_time()
+	{
+		return queue.empty() ? std::numeric_limits<double>::infinity() : queue.top().time;
+	}
+
+	void save_state(restart_writer_t *out)
+	{
+		std::priority_queue<event_t, std::vector<event_t>, std::greater<event_t> > pending = queue;
+		out->put<uint64_t>(pending.size());
+		for (; !pending.empty(); pending.pop()) out->put(pending.top());
+	}
+	void load_state(restart_reader_t *in)
+	{
+		for (size_t count = in->get<uint64_t>(); count > 0; --count) queue.push(in->get<event_t>());
+	}
+
+	// Remove every event that is due at the given timestep (or earlier), in dispatch order.
+	void pop_due(double time, std::vector<event_t> *output)
+	{
+		output->clear();
+		while (!queue.empty() && queue.top().time <= time)
+		{
+			output->push_back(queue.top());
+			queue.pop();
+		}
+	}
+};
\ No newline at end of file
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <vector>
+
+#include "types.h"
+#include "restart_io.h"
+
+// Incrementally maintained information about a single grain.
+struct grain_record_t
+{
+	// The number of voxels within the grain.
+	size_t volume = 0;
+	// The number of voxels within the grain that touch at least one other grain.
+	size_t boundary_voxels = 0;
+
+	// A box (inclusive, in lattice coordinates) that contains every voxel of the grain. The box grows as voxels are added, but
+	// removing a voxel from one of its faces only marks it as loose, since shrinking it requires a scan (see lattice_t::grain_bounds()).
+	// Grains that wrap around the periodic edges of the lattice end up with a box that spans the whole lattice along that axis.
+	coord_t min_x = 0, min_y = 0, min_z = 0, max_x = -1, max_y = -1, max_z = -1;
+	bool loose_bounds = false;
+};
+
+// Keeps a record for every grain, updated voxel by voxel as the lattice changes.
+struct grain_index_t
+{
+	// The record for each (dense) spin (index 0 is unused).
+	std::vector<grain_record_t> grains;
+	// The number of grains that still have at least one voxel.
+	spin_t live_grain_count = 0;
+	// Grains that have disappeared since the last call to take_vanished_grains() (in the order that they disappeared).
+	std::vector<spin_t> vanished_grains;
+
+	// Size the index for spins 1..spin_count and clear all records.
+	void reset(spin_t spin_count)
+	{
+		grains.assign(spin_count + 1, grain_record_t());
+		live_grain_count = 0;
+		vanished_grains.clear();
+	}
+
+	// Add a voxel to a grain.
+	void add_voxel(spin_t spin, coord_t x, coord_t y, coord_t z)
+	{
+		grain_record_t *grain = &grains[spin];
+		if (grain->volume++ == 0)
+		{
+			grain->min_x = grain->max_x = x;
+			grain->min_y = grain->max_y = y;
+			grain->min_z = grain->max_z = z;
+			grain->loose_bounds = false;
+			++live_grain_count;
+			return;
+		}
+
+		if (x < grain->min_x) grain->min_x = x;
+		if (x > grain->max_x) grain->max_x = x;
+		if (y < grain->min_y) grain->min_y = y;
+		if (y > grain->max_y) grain->max_y = y;
+		if (z < grain->min_z) grain->min_z = z;
+		if (z > grain->max_z) grain->max_z = z;
+	}
+
+	// Remove a voxel from a grain.
+	void remove_voxel(spin_t spin, coord_t x, coord_t y, coord_t z)
+	{
+		grain_record_t *grain = &grains[spin];
+		if (--grain->volume == 0)
+		{
+			grain->max_x = grain->max_y = grain->max_z = -1;
+			--live_grain_count;
+			vanished_grains.push_back(spin);
+			return;
+		}
+
+		if (x == grain->min_x || x == grain->max_x || y == grain->min_y || y == grain->max_y || z == grain->min_z || z == grain->max_z)
+		{
+			grain->loose_bounds = true;
+		}
+	}
+
+	// Change the number of boundary voxels within a grain.
+	void boundary_delta(spin_t spin, int delta)
+	{
+		grains[spin].boundary_voxels += delta;
+	}
+
+	// Get (and clear) the list of grains that have disappeared.
+	std::vector<spin_t> take_vanished_grains()
+	{
+		std::vector<spin_t> output;
+		output.swap(vanished_grains);
+		return output;
+	}
+
+	void save_state(restart_writer_t *out)
+	{
+		out->put_vector(grains);
+		out->put(live_grain_count);
+		out->put_vector(vanished_grains);
+	}
+	void load_state(restart_reader_t *in)
+	{
+		in->get_vector(&grains);
+		live_grain_count = in->get<spin_t>();
+		in->get_vector(&vanished_grains);
+	}
+};
\ No newline at end of file
@@ -20,11 +20,21 @@ William E. Frazier
 #include "voxel.h"
 #include "octree3.h"
 #include "boundaries2.h"
+#include "lattice_features.h"
+#include "grains.h"
+#include "analysis_stats.h"
+#include "page_alloc.h"
+#include "restart_io.h"
+#include "trajectory_recorder.h"
 
 #include <cmath>
 #include <random>
-#include <set>
+#include <vector>
+#include <algorithm>
 #include <fstream>
+#include <thread>
+#include <sstream>
+#include <csignal>
 
 // An object representing a voxel lattice.
 class lattice_t
@@ -36,13 +46,15 @@ private:
 	char NEIGHBOR_LOOKUP_Y[NEIGH_COUNT];
 	char NEIGHBOR_LOOKUP_Z[NEIGH_COUNT];
 
-	// A lookup table for the e^(-dE / kT) term for each possible dE (-26 to 26) since repeated computation may be expensive.
-	activ_t PROB_ETERM_LOOKUP[NEIGH_COUNT * 2 + 1];
+public:
+	// The maximum number of boundary (complexion) classes.
+	static const unsigned char MAX_BOUNDARY_CLASSES = 16;
 
-	// Temperature that the simulation should run at.
-	const activ_t kT = 0.5;
+private:
+	// A lookup table for the flip probability M * e^(-E * dE / kT) of each boundary class for each possible dE (-26 to 26), since repeated computation may be expensive.
+	activ_t PROB_LOOKUP[MAX_BOUNDARY_CLASSES][NEIGH_COUNT * 2 + 1];
 
-	// Build the neighbor offset and e-term lookup tables.
+	// Build the neighbor offset and probability lookup tables.
 	void build_lookup_tables()
 	{
 		// "Neighbors" of a voxel are all 26 surrounding voxels.
@@ -61,16 +73,20 @@ private:
 					++offset_index;
 				}
 		
-		for (char de = -NEIGH_COUNT; de <= NEIGH_COUNT; ++de)
-		{
-			PROB_ETERM_LOOKUP[de + NEIGH_COUNT] = exp((-de) / (kT));
-		}
+		// Flips that lower the energy always happen at the full mobility.
+		for (unsigned char c = 0; c < MAX_BOUNDARY_CLASSES; ++c)
+			for (char de = -NEIGH_COUNT; de <= NEIGH_COUNT; ++de)
+			{
+				PROB_LOOKUP[c][de + NEIGH_COUNT] = de < 0 ? class_mobility[c] : class_mobility[c] * exp((-de * class_energy[c]) / (kT));
+			}
 	}
 
-	// Get the mobility between two grains.
-	activ_t get_mobility(spin_t a, spin_t b)
+	// Get the class of the boundary between two grains (without transitions, every boundary stays in the default class).
+	template <typename F = all_lattice_features_t>
+	unsigned char get_boundary_class(spin_t a, spin_t b)
 	{
-		return boundary_tracker.is_transformed(a, b) ? transitioned_mobility : default_mobility;
+		if (!F::transitions) return 0;
+		return boundary_tracker.find_or_create_boundary(a, b)->boundary_class;
 	}
 
 	const char NO_DELTA_E_NEIGHBOR = -50;
@@ -101,6 +117,7 @@ private:
 	}
 	// Get the probability of a voxel flipping to a new spin.
 	// Calculated from Eq. 4.2 on page 42 of Frazier PhD thesis.
+	template <typename F = all_lattice_features_t>
 	activ_t get_prob(coord_t x, coord_t y, coord_t z, size_t new_spin)
 	{
 		spin_t curr_spin = voxel_at(x, y, z)->spin;
@@ -108,8 +125,7 @@ private:
 
 		char dE = get_deltaE(x, y, z, new_spin);
 		if (dE == NO_DELTA_E_NEIGHBOR) return 0;
-		else if (dE < 0) return get_mobility(curr_spin, new_spin);
-		else return get_mobility(curr_spin, new_spin) * PROB_ETERM_LOOKUP[dE + NEIGH_COUNT];
+		else return PROB_LOOKUP[get_boundary_class<F>(curr_spin, new_spin)][dE + NEIGH_COUNT];
 	}
 
 	// Get a random float value between min and max.
@@ -119,20 +135,39 @@ private:
 		return (rng_dis(rng_gen) * (max - min)) + min;
 	}
 
+	// Heap comparator that puts the boundary with the smallest area on top (ties are broken by spin so that the order is deterministic).
+	static bool larger_boundary(boundary_t *a, boundary_t *b)
+	{
+		if (a->area() != b->area()) return a->area() > b->area();
+		if (a->a_spin != b->a_spin) return a->a_spin > b->a_spin;
+		return a->b_spin > b->b_spin;
+	}
+
+	// Get a random index within a collection of the given size (0..size-1).
+	size_t random_index(size_t size)
+	{
+		size_t index = rng(0, size);
+		return index < size ? index : size - 1;
+	}
+
 	// Clear and recalculate the overall activity for a voxel.
+	template <typename F>
 	void rebuild_voxel_activity(coord_t x, coord_t y, coord_t z)
 	{
 		voxel_t *v = voxel_at(x, y, z);
+		bool was_on_boundary = v->on_boundary();
 		// Expand on voxel operations in comments.!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 		for (char n = 0; n < NEIGH_COUNT; ++n)
 		{
 			size_t nspin = neighbor_at(x, y, z, n)->spin;
 			if (nspin == v->spin || v->has_neighbor(nspin)) continue;
 
-			activ_tree->delta(x, y, z, v->set_neighbor(nspin, get_prob(x, y, z, nspin), &boundary_tracker));
+			activ_tree->delta(x, y, z, v->set_neighbor<F>(nspin, get_prob<F>(x, y, z, nspin), &boundary_tracker));
 		}
+		if (v->on_boundary() != was_on_boundary) grain_index.boundary_delta(v->spin, was_on_boundary ? -1 : 1);
 	}
 	// Recalculate the activity for a single neighbor of a voxel.
+	template <typename F>
 	void rebuild_neighbor_activity(coord_t x, coord_t y, coord_t z, size_t nspin)
 	{
 		x = (x + side_length) % side_length;
@@ -140,31 +175,123 @@ private:
 		z = (z + side_length) % side_length;
 
 		voxel_t *v = voxel_at(x, y, z);
+		bool was_on_boundary = v->on_boundary();
 
-		activ_t new_prob = get_prob(x, y, z, nspin);
-		activ_tree->delta(x, y, z, v->set_neighbor(nspin, new_prob, &boundary_tracker));
+		activ_t new_prob = get_prob<F>(x, y, z, nspin);
+		activ_tree->delta(x, y, z, v->set_neighbor<F>(nspin, new_prob, &boundary_tracker));
+		if (v->on_boundary() != was_on_boundary) grain_index.boundary_delta(v->spin, was_on_boundary ? -1 : 1);
 	}
 
 	// Flip a voxel to a new spin.
 	// NOTE: Due to the fact that neighboring spins are accessed/updated, this prevents the simulation from being easily parallelizable (among many other things).
+	template <typename F>
 	void flip_voxel(coord_t x, coord_t y, coord_t z, spin_t new_spin)
 	{
 		voxel_t *v = voxel_at(x, y, z);
 		spin_t old_spin = v->spin;
-		activ_tree->delta(x, y, z, v->reset(&boundary_tracker));
+		grain_index.remove_voxel(old_spin, x, y, z);
+		if (v->on_boundary()) grain_index.boundary_delta(old_spin, -1);
+		activ_tree->delta(x, y, z, v->reset<F>(&boundary_tracker));
 		v->spin = new_spin;
+		grain_index.add_voxel(new_spin, x, y, z);
 
-		rebuild_voxel_activity(x, y, z);
+		rebuild_voxel_activity<F>(x, y, z);
 		for (char n = 0; n < NEIGH_COUNT; ++n)
 		{
-			rebuild_neighbor_activity(x + NEIGHBOR_LOOKUP_X[n], y + NEIGHBOR_LOOKUP_Y[n], z + NEIGHBOR_LOOKUP_Z[n], old_spin);
-			rebuild_neighbor_activity(x + NEIGHBOR_LOOKUP_X[n], y + NEIGHBOR_LOOKUP_Y[n], z + NEIGHBOR_LOOKUP_Z[n], new_spin);
+			rebuild_neighbor_activity<F>(x + NEIGHBOR_LOOKUP_X[n], y + NEIGHBOR_LOOKUP_Y[n], z + NEIGHBOR_LOOKUP_Z[n], old_spin);
+			rebuild_neighbor_activity<F>(x + NEIGHBOR_LOOKUP_X[n], y + NEIGHBOR_LOOKUP_Y[n], z + NEIGHBOR_LOOKUP_Z[n], new_spin);
 		}
 
-		boundary_tracker.track_flip(old_spin, new_spin);
+		// Only the pairs between the flipped voxel and its neighbors change.
+		int old_neighbors = 0, new_neighbors = 0;
+		for (char n = 0; n < NEIGH_COUNT; ++n)
+		{
+			spin_t nspin = neighbor_at(x, y, z, n)->spin;
+			old_neighbors += nspin == old_spin;
+			new_neighbors += nspin == new_spin;
+		}
+		boundary_energy += old_neighbors - new_neighbors;
+
+		if (F::face_counts)
+		{
+			spin_t face_spins[6] =
+			{
+				voxel_at(x - 1, y, z)->spin, voxel_at(x + 1, y, z)->spin,
+				voxel_at(x, y - 1, z)->spin, voxel_at(x, y + 1, z)->spin,
+				voxel_at(x, y, z - 1)->spin, voxel_at(x, y, z + 1)->spin
+			};
+			face_tracker.flip(face_spins, old_spin, new_spin);
+		}
+
+		if (F::analysis)
+		{
+			boundary_tracker.track_flip(old_spin, new_spin);
+			update_analysis_stats(x, y, z, old_spin, new_spin);
+		}
 
 		++total_flips;
-		if (boundary_tracker.is_transformed(old_spin, new_spin)) ++transformed_flips;
+		if (F::transitions && boundary_tracker.is_transformed(old_spin, new_spin)) ++transformed_flips;
+	}
+
+	// Update the analysis statistics for a voxel that has flipped (only its 3x3x3 neighborhood is affected).
+	void update_analysis_stats(coord_t x, coord_t y, coord_t z, spin_t old_spin, spin_t new_spin)
+	{
+		spin_t neighborhood[27];
+		for (char dz = -1; dz <= 1; ++dz)
+			for (char dy = -1; dy <= 1; ++dy)
+				for (char dx = -1; dx <= 1; ++dx)
+				{
+					neighborhood[analysis_tracker_t::neighborhood_index(dx, dy, dz)] = voxel_at(x + dx, y + dy, z + dz)->spin;
+				}
+
+		analysis_tracker.flip(neighborhood, old_spin, new_spin);
+	}
+
+	// Recount the faces shared by each pair of grains across the whole lattice (through the voxel on the lower side of each face).
+	void rebuild_face_counts()
+	{
+		face_tracker.reset(spin_count);
+
+		for (coord_t z = 0; z < side_length; ++z)
+			for (coord_t y = 0; y < side_length; ++y)
+				for (coord_t x = 0; x < side_length; ++x)
+				{
+					spin_t
+						curr_id = voxel_at(x, y, z)->spin,
+						x_id = voxel_at(x + 1, y, z)->spin,
+						y_id = voxel_at(x, y + 1, z)->spin,
+						z_id = voxel_at(x, y, z + 1)->spin;
+
+					if (curr_id != x_id) face_tracker.add_face(curr_id, x_id, 1);
+					if (curr_id != y_id) face_tracker.add_face(curr_id, y_id, 1);
+					if (curr_id != z_id) face_tracker.add_face(curr_id, z_id, 1);
+				}
+	}
+
+	// Recount the analysis statistics across the whole lattice. Every face and 2x2 square is visited once, through the voxel at its
+	// lowest corner (wrapping around the edges).
+	void rebuild_analysis_stats()
+	{
+		analysis_tracker.reset(spin_count);
+
+		for (coord_t z = 0; z < side_length; ++z)
+			for (coord_t y = 0; y < side_length; ++y)
+				for (coord_t x = 0; x < side_length; ++x)
+				{
+					spin_t
+						curr_id = voxel_at(x, y, z)->spin,
+						x_id = voxel_at(x + 1, y, z)->spin,
+						y_id = voxel_at(x, y + 1, z)->spin,
+						z_id = voxel_at(x, y, z + 1)->spin;
+
+					if (curr_id != x_id) analysis_tracker.add_face(curr_id, x_id, 1);
+					if (curr_id != y_id) analysis_tracker.add_face(curr_id, y_id, 1);
+					if (curr_id != z_id) analysis_tracker.add_face(curr_id, z_id, 1);
+
+					analysis_tracker.add_square(curr_id, x_id, y_id, voxel_at(x + 1, y + 1, z)->spin, 1);
+					analysis_tracker.add_square(curr_id, x_id, z_id, voxel_at(x + 1, y, z + 1)->spin, 1);
+					analysis_tracker.add_square(curr_id, y_id, z_id, voxel_at(x, y + 1, z + 1)->spin, 1);
+				}
 	}
 
 	// Probabilistically find a voxel that can be flipped based on a random activity (1..system_activity).
@@ -201,16 +328,148 @@ public:
 	voxel_t *voxels;
 	// A counter on the total number of flips the simulation has conducted so far.
 	size_t total_flips;
+	// The current simulation time, and the time that the last flip took (in timesteps).
+	double time, last_dt;
 	octree3_t *activ_tree;
-	activ_t default_mobility, transitioned_mobility;
+	// The mobility and (relative) energy of each boundary class (must be set before init()).
+	// Every boundary starts out in class 0, and boundaries move to transitioned_class when they are transformed.
+	activ_t class_mobility[MAX_BOUNDARY_CLASSES], class_energy[MAX_BOUNDARY_CLASSES];
+	unsigned char transitioned_class;
+	// Temperature that the simulation should run at (must be set before init()).
+	activ_t kT;
 	size_t transformed_flips;
 
 	// Total number of possible grains in the simulation.
 	// In Holm's code this is a constant value, here we set it to the number of grains within the initial state.
 	spin_t grain_count;
 
+	// The number of distinct grains within the initial state. Once compacted, spins are numbered densely from 1 to spin_count,
+	// so per-grain data can be stored in flat arrays indexed by spin.
+	spin_t spin_count;
+	// The original grain ID of each dense spin (index 0 is unused, since a spin of 0 means "no neighbor").
+	std::vector<spin_t> spin_labels;
+
+	// Get the original grain ID of a spin (spins are returned as-is before the lattice has been compacted).
+	spin_t original_spin(spin_t spin)
+	{
+		return spin < spin_labels.size() ? spin_labels[spin] : spin;
+	}
+
+	// Renumber all grain IDs into the dense range 1..spin_count, keeping the original IDs in spin_labels.
+	// Original IDs keep their relative order, and the renumbering is undone on output.
+	void compact_spins()
+	{
+		size_t voxel_count = (size_t)side_length * side_length * side_length;
+
+		// An already-compacted lattice maps onto itself.
+		if (!spin_labels.empty()) return;
+
+		std::unordered_set<spin_t> unique_spins;
+		for (size_t i = 0; i < voxel_count; ++i)
+		{
+			unique_spins.insert(voxels[i].spin);
+		}
+
+		spin_labels.assign(1, 0);
+		spin_labels.insert(spin_labels.end(), unique_spins.begin(), unique_spins.end());
+		std::sort(spin_labels.begin() + 1, spin_labels.end());
+		spin_count = spin_labels.size() - 1;
+
+		std::unordered_map<spin_t, spin_t> dense_spins;
+		for (spin_t s = 1; s <= spin_count; ++s)
+		{
+			dense_spins[spin_labels[s]] = s;
+		}
+		for (size_t i = 0; i < voxel_count; ++i)
+		{
+			voxels[i].spin = dense_spins[voxels[i].spin];
+		}
+
+		std::cout << "Compacted " << spin_count << " grain IDs." << std::endl;
+	}
+
 	// An object that tracks and controls grain boundary transformations.
 	boundary_tracker_t boundary_tracker;
+	// Per-grain records, kept up to date with every flip (indexed by dense spin).
+	grain_index_t grain_index;
+	// The faces shared by each pair of grains (only kept up to date when the face_counts feature is enabled).
+	face_tracker_t face_tracker;
+	// Per-boundary surface areas and curvature outies (only kept up to date when the analysis feature is enabled).
+	analysis_tracker_t analysis_tracker;
+	// The total boundary energy, i.e. the number of neighboring (26-connected) voxel pairs that belong to different grains.
+	size_t boundary_energy;
+
+	// Get the mean volume of the grains that are still present.
+	double mean_grain_volume()
+	{
+		return live_grain_count() > 0 ? (double)side_length * side_length * side_length / live_grain_count() : 0;
+	}
+	// Get the number of pairs of grains that share at least one face (requires the analysis or face_counts feature).
+	size_t boundary_count()
+	{
+		return (this->*boundary_count_fn)();
+	}
+
+	// Get the number of grains that still have at least one voxel.
+	spin_t live_grain_count()
+	{
+		return grain_index.live_grain_count;
+	}
+	// Get the record for a grain (the bounding box may be loose, see grain_bounds()).
+	const grain_record_t &grain_record(spin_t spin)
+	{
+		return grain_index.grains[spin];
+	}
+	// Get the record for a grain with a tight bounding box. Tightening a loose box costs a scan of the box (not the lattice).
+	const grain_record_t &grain_bounds(spin_t spin)
+	{
+		grain_record_t *grain = &grain_index.grains[spin];
+		if (!grain->loose_bounds || grain->volume == 0) return *grain;
+
+		coord_t min_x = side_length, min_y = side_length, min_z = side_length, max_x = -1, max_y = -1, max_z = -1;
+		for (coord_t z = grain->min_z; z <= grain->max_z; ++z)
+			for (coord_t y = grain->min_y; y <= grain->max_y; ++y)
+				for (coord_t x = grain->min_x; x <= grain->max_x; ++x)
+				{
+					if (voxels[x + (y * side_length) + (z * side_length * side_length)].spin != spin) continue;
+
+					if (x < min_x) min_x = x;
+					if (x > max_x) max_x = x;
+					if (y < min_y) min_y = y;
+					if (y > max_y) max_y = y;
+					if (z < min_z) min_z = z;
+					if (z > max_z) max_z = z;
+				}
+
+		grain->min_x = min_x;
+		grain->min_y = min_y;
+		grain->min_z = min_z;
+		grain->max_x = max_x;
+		grain->max_y = max_y;
+		grain->max_z = max_z;
+		grain->loose_bounds = false;
+		return *grain;
+	}
+	// Collect the indices of all voxels within a grain (costs a scan of the grain's bounding box).
+	void grain_voxels(spin_t spin, std::vector<size_t> *output)
+	{
+		const grain_record_t &grain = grain_bounds(spin);
+		output->clear();
+		output->reserve(grain.volume);
+
+		for (coord_t z = grain.min_z; z <= grain.max_z; ++z)
+			for (coord_t y = grain.min_y; y <= grain.max_y; ++y)
+				for (coord_t x = grain.min_x; x <= grain.max_x; ++x)
+				{
+					size_t index = x + (y * side_length) + (z * side_length * side_length);
+					if (voxels[index].spin == spin) output->push_back(index);
+				}
+	}
+	// Get (and clear) the list of grains that have disappeared since the last call (each grain can only disappear once).
+	std::vector<spin_t> take_vanished_grains()
+	{
+		return grain_index.take_vanished_grains();
+	}
 
 	// Get the overall activity within the lattice.
 	activ_t system_activity()
@@ -222,11 +481,20 @@ public:
 	lattice_t(coord_t dim_size)
 	{
 		side_length = dim_size;
-		voxels = new voxel_t[side_length * side_length * side_length];
+		voxels = page_alloc<voxel_t>((size_t)side_length * side_length * side_length, "voxels");
 		total_flips = 0;
+		time = last_dt = 0;
+		spin_count = 0;
+		boundary_energy = 0;
 
-		default_mobility = 0.002;
-		transitioned_mobility = 0.04;
+		for (unsigned char c = 0; c < MAX_BOUNDARY_CLASSES; ++c)
+		{
+			class_mobility[c] = 0.002;
+			class_energy[c] = 1;
+		}
+		class_mobility[1] = 0.04;
+		transitioned_class = 1;
+		kT = 0.5;
 
 		total_flips = transformed_flips = 0;
 
@@ -240,6 +508,8 @@ public:
 		}
 		activ_tree = new octree3_t(next_highest_power_of_2, log2(next_highest_power_of_2) + 1);
 
+		use_features<all_lattice_features_t>();
+
 		rng_gen = std::mt19937(1337);
 		rng_dis = std::uniform_real_distribution<>(0.0, 1.0);
 
@@ -247,35 +517,58 @@ public:
 	}
 	~lattice_t()
 	{
-		delete voxels;
+		page_free(voxels, (size_t)side_length * side_length * side_length);
 		delete activ_tree;
 	}
 
 private:
-	bool log_transitions;
+	bool log_transitions = false;
 	std::ofstream transition_log_file;
-	double log_timestep;
+	double log_timestep = 0;
+	// Log lines that have not been handed to write_transition_log() yet.
+	std::string transition_log_buffer;
 
 public:
 	// Start logging transitions to the log file.
-	void begin_logging_transitions(std::string output_folder)
+	// When resuming from a restart file, the log is cut back to the size it had when the restart file was written and appended to.
+	void begin_logging_transitions(std::string output_folder, long resume_offset = -1)
 	{
 		std::cout << "Starting to log transitions..." << std::endl;
 
 		output_folder += "transitions.txt";
 		log_transitions = true;
-		transition_log_file = std::ofstream(output_folder.c_str());
+		open_resumable_file(&transition_log_file, output_folder, resume_offset);
+	}
+	// Get the current size of the log file (flushing it first).
+	long log_file_offset()
+	{
+		flush_log_file();
+		return transition_log_file.tellp();
 	}
 	// Stop logging transitions to the log file.
 	void stop_logging_transitions()
 	{
+		flush_log_file();
 		log_transitions = false;
 		transition_log_file.close();
 	}
+	// Take the log lines written since the last call, so that they can be written out later (e.g. by a background writer).
+	std::string take_transition_log()
+	{
+		std::string lines;
+		lines.swap(transition_log_buffer);
+		return lines;
+	}
+	// Append lines taken with take_transition_log() to the log file. Calls must not overlap, and must be made in the order the lines were taken.
+	void write_transition_log(const std::string &lines)
+	{
+		transition_log_file << lines;
+		std::flush(transition_log_file);
+	}
 	// Write changes to the log file.
 	void flush_log_file()
 	{
-		std::flush(transition_log_file);
+		write_transition_log(take_transition_log());
 	}
 	// Set the log's current timestep.
 	void set_log_timestep(double timestep)
@@ -309,33 +602,185 @@ public:
 
 	// Initialize the lattice (used to build initial activity values at the start of the simulation).
 	void init()
+	{
+		(this->*init_fn)();
+	}
+
+	// Step the simulation forward, performing a single voxel flip (returns the number of timesteps that the flip theoretically took).
+	double step()
+	{
+		last_dt = (this->*step_fn)();
+		time += last_dt;
+		return last_dt;
+	}
+
+	// If set, run_until() also returns (early) as soon as this becomes nonzero (e.g. from a signal handler).
+	const volatile std::sig_atomic_t *interrupt = nullptr;
+	// If set, every flip and boundary transition is recorded to it.
+	trajectory_recorder_t *trajectory = nullptr;
+
+	// Keep flipping voxels until the simulation time reaches end_time. At least one flip is always performed, so that events
+	// which are due at the current time are never dispatched twice for the same state.
+	void run_until(double end_time)
+	{
+		(this->*run_fn)(end_time);
+	}
+
+	// Transitition a certain number of random grain boundaries (all at once).
+	void transition_boundaries(size_t count, double propagation_chance, double propagation_ratio)
+	{
+		begin_transitions(count, propagation_chance, propagation_ratio);
+		finish_transitions();
+	}
+
+	// Move the boundary between two grains into a different class (classes only take effect when transitions are enabled).
+	void assign_boundary_class(spin_t a, spin_t b, unsigned char boundary_class)
+	{
+		(this->*class_fn)(boundary_tracker.find_or_create_boundary(a, b), boundary_class);
+	}
+
+	// Write the complete state of the lattice to a restart file: voxels, activity tree, boundaries, grain records, face counts, analysis statistics,
+	// the pending transition pass and the random number generator. The boundary classes and other settings come from the config.
+	void save_state(restart_writer_t *out)
+	{
+		size_t voxel_count = (size_t)side_length * side_length * side_length;
+
+		out->put(side_length);
+		out->put<uint32_t>(sizeof(voxel_t));
+		out->put(spin_count);
+		out->put_vector(spin_labels);
+		out->put(grain_count);
+		out->put<uint64_t>(total_flips);
+		out->put<uint64_t>(transformed_flips);
+		out->put(time);
+		out->put(last_dt);
+		out->put<uint64_t>(boundary_energy);
+		out->put(transition_job);
+		out->put(log_timestep);
+
+		std::ostringstream rng_state;
+		rng_state << rng_gen << ' ' << rng_dis;
+		out->put_string(rng_state.str());
+
+		out->put_array(voxels, voxel_count);
+		activ_tree->save_state(out);
+		boundary_tracker.save_state(out);
+		grain_index.save_state(out);
+		face_tracker.save_state(out);
+		analysis_tracker.save_state(out);
+	}
+
+	// Create a lattice from the state written by save_state(). Call resume() instead of init() before stepping it.
+	static lattice_t *from_restart(restart_reader_t *in)
+	{
+		lattice_t *lattice = new lattice_t(in->get<coord_t>());
+		size_t voxel_count = (size_t)lattice->side_length * lattice->side_length * lattice->side_length;
+
+		if (in->get<uint32_t>() != sizeof(voxel_t))
+		{
+			std::cout << "Error: The restart file was written by an incompatible build." << std::endl;
+			exit(0);
+		}
+		lattice->spin_count = in->get<spin_t>();
+		in->get_vector(&lattice->spin_labels);
+		lattice->grain_count = in->get<spin_t>();
+		lattice->total_flips = in->get<uint64_t>();
+		lattice->transformed_flips = in->get<uint64_t>();
+		lattice->time = in->get<double>();
+		lattice->last_dt = in->get<double>();
+		lattice->boundary_energy = in->get<uint64_t>();
+		lattice->transition_job = in->get<transition_job_t>();
+		lattice->log_timestep = in->get<double>();
+
+		std::istringstream rng_state(in->get_string());
+		rng_state >> lattice->rng_gen >> lattice->rng_dis;
+
+		in->get_array(lattice->voxels, voxel_count);
+		lattice->activ_tree->load_state(in);
+		lattice->boundary_tracker.load_state(in);
+		lattice->grain_index.load_state(in);
+		lattice->face_tracker.load_state(in);
+		lattice->analysis_tracker.load_state(in);
+
+		return lattice;
+	}
+
+	// Prepare a lattice that was created by from_restart() for stepping (the counterpart of init(), which must not be called).
+	void resume()
+	{
+		build_lookup_tables();
+		std::cout << "Resuming at T = " << time << " (" << total_flips << " flips)." << std::endl;
+	}
+
+	// Select the feature set that the lattice engine is instantiated with (must be called before init()).
+	template <typename F>
+	void use_features()
+	{
+		class_fn = &lattice_t::set_boundary_class<F>;
+		init_fn = &lattice_t::init_impl<F>;
+		step_fn = &lattice_t::step_impl<F>;
+		run_fn = &lattice_t::run_until_impl<F>;
+		transition_fn = &lattice_t::run_transition_job<F>;
+		boundary_count_fn = &lattice_t::boundary_count_impl<F>;
+	}
+
+private:
+	// The instantiations of the engine entry points for the selected feature set.
+	void (lattice_t::*init_fn)();
+	double (lattice_t::*step_fn)();
+	void (lattice_t::*run_fn)(double);
+	bool (lattice_t::*transition_fn)(size_t);
+	void (lattice_t::*class_fn)(boundary_t *, unsigned char);
+	size_t (lattice_t::*boundary_count_fn)();
+
+	// The analysis statistics hold the face counts when they are kept, and the face tracker holds them otherwise.
+	template <typename F>
+	size_t boundary_count_impl()
+	{
+		return F::analysis ? analysis_tracker.boundary_count : face_tracker.boundary_count;
+	}
+
+	template <typename F>
+	void init_impl()
 	{
 		std::cout << "Initializing..." << std::endl;
 
 		build_lookup_tables();
 
-		std::unordered_set<spin_t> spins;
+		compact_spins();
+		boundary_tracker.resize(spin_count);
+		grain_index.reset(spin_count);
+		boundary_energy = 0;
 
 		for(coord_t z = 0; z < side_length; ++z)
 			for (coord_t y = 0; y < side_length; ++y)
 				for (coord_t x = 0; x < side_length; ++x)
 				{
 					voxel_at(x, y, z)->index = index_at(x, y, z);
-					if (grain_count <= 0) spins.insert(voxel_at(x, y, z)->spin);
+					grain_index.add_voxel(voxel_at(x, y, z)->spin, x, y, z);
+
+					rebuild_voxel_activity<F>(x, y, z);
 
-					rebuild_voxel_activity(x, y, z);
+					// Every pair is seen from both sides, so only pairs towards a "later" neighbor are counted.
+					for (char n = NEIGH_COUNT / 2; n < NEIGH_COUNT; ++n)
+					{
+						if (neighbor_at(x, y, z, n)->spin != voxel_at(x, y, z)->spin) ++boundary_energy;
+					}
 				}
 
+		if (F::face_counts) rebuild_face_counts();
+		if (F::analysis) rebuild_analysis_stats();
+
 		if (grain_count <= 0)
 		{
-			grain_count = spins.size();
+			grain_count = spin_count;
 		}
 
 		std::cout << "Done initializing." << std::endl;
 	}
 
-	// Step the simulation forward, performing a single voxel flip (returns the number of timesteps that the flip theoretically took).
-	double step()
+	template <typename F>
+	double step_impl()
 	{
 		activ_t rand_activ;
 		// Sometimes rand_activ is greater than system_activity() (I think), so this is a hack to prevent that.
@@ -361,209 +806,346 @@ public:
 		} while (rand_activ >= voxel_at(vx, vy, vz)->activity);
 
 		spin_t new_spin = voxel_at(vx, vy, vz)->choose_neighbor(rand_activ);
-		flip_voxel(vx, vy, vz, new_spin);
+		flip_voxel<F>(vx, vy, vz, new_spin);
 
 		// This expression is taken from Eq. 20 in Hassold/Holm 1993.
-		return -((double)grain_count - 1) * log(rng(0.01f, 0.99f)) / system_activity();
+		double dt = -((double)grain_count - 1) * log(rng(0.01f, 0.99f)) / system_activity();
+
+		// Spend part of the per-step budget on a pending transition pass.
+		if (F::transitions && transition_job.phase != transition_job_t::IDLE) run_transition_job<F>(transition_step_budget > 0 ? transition_step_budget : (size_t)-1);
+
+		// The flip is recorded at the time the step ends at (after any transitions that happened during the step).
+		if (trajectory != nullptr) trajectory->record_flip(vx + (size_t)vy * side_length + (size_t)vz * side_length * side_length, original_spin(new_spin), time + dt);
+
+		return dt;
+	}
+
+	template <typename F>
+	void run_until_impl(double end_time)
+	{
+		do
+		{
+			last_dt = step_impl<F>();
+			time += last_dt;
+		} while (time < end_time && (interrupt == nullptr || !*interrupt));
 	}
 
 private:
-	void transition_boundary(boundary_t *boundary)
+	// The minimum number of boundary voxels handled by each thread when rescaling a boundary's activities.
+	static const size_t MIN_VOXELS_PER_RESCALE_THREAD = 16384;
+
+	// Scratch space for rescale_boundary_activity().
+	std::vector<size_t> rescale_indices;
+	std::vector<octree3_t::pending_delta_t> rescale_deltas;
+
+	// Rescale the flip probabilities across a boundary by the ratio between its new and old mobility.
+	// Only the neighbor slots for the boundary's spin pair depend on its mobility, and every voxel that holds such a slot is on the boundary,
+	// so the result matches a full rebuild without having to recompute any dE. Large boundaries are split across threads (each voxel is only
+	// touched once), and the activity changes are pushed into the octree as a single batch.
+	void rescale_boundary_activity(boundary_t *boundary, activ_t ratio)
 	{
-		boundary_tracker.mark_transformed(boundary);
+		rescale_indices.assign(boundary->boundary_voxel_indices.begin(), boundary->boundary_voxel_indices.end());
+		rescale_deltas.resize(rescale_indices.size());
+
+		auto rescale_range = [this, boundary, ratio](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				voxel_t *v = &voxels[rescale_indices[i]];
+				octree3_t::pending_delta_t *delta = &rescale_deltas[i];
+
+				from_index(rescale_indices[i], &delta->x, &delta->y, &delta->z);
+				delta->dA = v->scale_neighbor(v->spin == boundary->a_spin ? boundary->b_spin : boundary->a_spin, ratio);
+			}
+		};
+
+		size_t thread_count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), rescale_indices.size() / MIN_VOXELS_PER_RESCALE_THREAD);
+		if (thread_count <= 1)
+		{
+			rescale_range(0, rescale_indices.size());
+		}
+		else
+		{
+			std::vector<std::thread> threads;
+			size_t chunk = (rescale_indices.size() + thread_count - 1) / thread_count;
+			for (size_t t = 1; t < thread_count; ++t)
+			{
+				threads.emplace_back(rescale_range, t * chunk, std::min(rescale_indices.size(), (t + 1) * chunk));
+			}
+			rescale_range(0, chunk);
+			for (auto thread_iter = threads.begin(); thread_iter != threads.end(); ++thread_iter)
+			{
+				thread_iter->join();
+			}
+		}
+
+		activ_tree->delta_batch(&rescale_deltas);
+	}
 
-		// Update voxel activities and octree for all voxels on the boundary.
+	// Fully recalculate the activities of all voxels on a boundary (and their neighbors).
+	template <typename F>
+	void rebuild_boundary_activity(boundary_t *boundary)
+	{
 		for (auto bvox_iter = boundary->boundary_voxel_indices.begin(); bvox_iter != boundary->boundary_voxel_indices.end(); ++bvox_iter)
 		{
 			coord_t x, y, z;
 			from_index(*bvox_iter, &x, &y, &z);
 
-			rebuild_voxel_activity(x, y, z);
+			rebuild_voxel_activity<F>(x, y, z);
 			for (char n = 0; n < NEIGH_COUNT; ++n)
 			{
-				rebuild_neighbor_activity(x + NEIGHBOR_LOOKUP_X[n], y + NEIGHBOR_LOOKUP_Y[n], z + NEIGHBOR_LOOKUP_Z[n], voxels[*bvox_iter].spin);
+				rebuild_neighbor_activity<F>(x + NEIGHBOR_LOOKUP_X[n], y + NEIGHBOR_LOOKUP_Y[n], z + NEIGHBOR_LOOKUP_Z[n], voxels[*bvox_iter].spin);
 			}
 		}
+	}
 
-		if (log_transitions)
+	// Move a boundary into a different class and update the voxel activities and octree for all voxels on the boundary.
+	template <typename F>
+	void set_boundary_class(boundary_t *boundary, unsigned char boundary_class)
+	{
+		unsigned char old_class = boundary->boundary_class;
+		if (old_class == boundary_class) return;
+
+		boundary->boundary_class = boundary_class;
+
+		// If only the mobility changes, the probabilities for the pair can simply be rescaled (which is impossible from a zero mobility).
+		// A change in energy affects each probability differently depending on its dE, so the boundary must be rebuilt instead.
+		if (class_energy[old_class] == class_energy[boundary_class] && class_mobility[old_class] > 0)
+		{
+			rescale_boundary_activity(boundary, class_mobility[boundary_class] / class_mobility[old_class]);
+		}
+		else
 		{
-			transition_log_file << boundary->a_spin << '\t' << boundary->b_spin << '\t' << std::to_string(log_timestep) << '\n';
+			rebuild_boundary_activity<F>(boundary);
 		}
 	}
 
-public:
+	template <typename F>
+	void transition_boundary(boundary_t *boundary)
+	{
+		boundary_tracker.mark_transformed(boundary);
+		set_boundary_class<F>(boundary, transitioned_class);
+
+		if (log_transitions)
+		{
+			transition_log_buffer += std::to_string(original_spin(boundary->a_spin)) + '\t' + std::to_string(original_spin(boundary->b_spin)) + '\t' + std::to_string(log_timestep) + '\n';
+		}
+		if (trajectory != nullptr) trajectory->record_transition(original_spin(boundary->a_spin), original_spin(boundary->b_spin), time);
+	}
 
-	// Transitition a certain number of random grain boundaries.
-	// Yes, I know this function is a mess. It can probably be simplified a bit...
-	void transition_boundaries(size_t count, double propagation_chance, double propagation_ratio, bool use_potential_energy)
+	// The state of a transition pass. A pass can either be run all at once, or be spread over subsequent steps with a per-step work budget.
+	struct transition_job_t
 	{
-		std::cout << "Transitioning " << count << " boundaries..." << std::endl;
+		enum phase_t : char { IDLE, FLIP, PROPAGATE, POTENTIAL_ENERGY };
 
-		std::set<size_t> flip_indices;
-		std::set<size_t> propagate_indices;
+		phase_t phase = IDLE;
+		double propagation_ratio = 0;
+		size_t flip_count = 0, propagate_count = 0;
+		// The number of boundaries that were transformed when the pass began.
+		size_t initial_transformed_count = 0;
+		// The current position within the phase (flips attempted, propagation sources visited, or transformed boundaries swept).
+		size_t position = 0;
 
-		boundary_tracker.remove_bad_boundaries();
+		size_t num_random_propagated = 0, num_random_flipped = 0, num_poteng_propagated = 0;
+	};
+	transition_job_t transition_job;
 
-		if (count > boundary_tracker.total_boundary_count - boundary_tracker.transformed_boundary_count)
-		{
-			count = boundary_tracker.total_boundary_count - boundary_tracker.transformed_boundary_count;
-		}
+	// Scratch space for the propagation and potential energy phases.
+	std::vector<boundary_t *> transition_candidates;
 
-		size_t
-			propagate_count = count * propagation_chance,
-			flip_count = count - propagate_count;
+	// Transition a boundary and return the amount of work that it took (in voxels and boundaries touched).
+	template <typename F>
+	size_t transition_boundary_work(boundary_t *boundary)
+	{
+		transition_boundary<F>(boundary);
+		return boundary->area() + 1;
+	}
 
-		if (boundary_tracker.transformed_boundary_count < propagate_count)
-		{
-			propagate_count = boundary_tracker.transformed_boundary_count;
-			flip_count = count - propagate_count;
-		}
-		
-		// flip_indices and propagate_indices are ordered sets that contain the "indices" of untransformed and
-		// transformed boundaries to flip/propagate on. Since unordered maps cannot be easily indexed, and
-		// the overall collections of untransformed and transformed boundaries are combined, each "index" refers
-		// to the i'th instance of that type of boundary. For example, if flip_indices contains the value "3", that
-		// tells the algorithm to flip the 4th (because of zero-indexing) untransformed boundary that it comes across.
-
-		size_t index;
-		for (size_t i = 0; i < flip_count; ++i)
+	// Continue the pending transition pass until it is done or the work budget is spent (returns true if the pass is done).
+	// Work is only ever checked between units (a flip, a propagation source, or a boundary's potential energy cascade), so a
+	// single unit is never split.
+	template <typename F>
+	bool run_transition_job(size_t budget)
+	{
+		transition_job_t *job = &transition_job;
+		std::vector<boundary_t *> *transformed_pool = &boundary_tracker.transformed_pool;
+		std::vector<boundary_t *> *untransformed_pool = &boundary_tracker.untransformed_pool;
+		size_t work = 0;
+
+		// Randomly flip untransformed boundaries. Transitioning a boundary swap-removes it from the untransformed pool, so it cannot be drawn twice.
+		while (job->phase == transition_job_t::FLIP)
 		{
-			do
+			if (job->position >= job->flip_count || untransformed_pool->empty())
+			{
+				job->phase = transition_job_t::PROPAGATE;
+				job->position = 0;
+				break;
+			}
+			if (work >= budget) return false;
+
+			// When spread over several steps, boundaries may have been created (without any area) since the cleanup, so redraw a few times to avoid them.
+			boundary_t *boundary = (*untransformed_pool)[random_index(untransformed_pool->size())];
+			for (char attempt = 0; attempt < 8 && boundary->area() == 0; ++attempt)
 			{
-				index = rng(0, boundary_tracker.total_boundary_count - boundary_tracker.transformed_boundary_count);
-			} while (flip_indices.find(index) != flip_indices.end());
-			flip_indices.insert(index);
+				boundary = (*untransformed_pool)[random_index(untransformed_pool->size())];
+			}
+
+			work += transition_boundary_work<F>(boundary);
+			++job->num_random_flipped;
+			++job->position;
 		}
-		for (size_t i = 0; i < propagate_count; ++i)
+
+		// Propagate from random transformed boundaries. Sources are drawn without replacement via a partial shuffle of the
+		// front of the transformed pool; a source without any untransformed junctions is simply skipped in favor of the next one.
+		// Transitioning only ever appends to the transformed pool (and boundaries are only deleted when a pass begins), so the
+		// boundaries that were transformed before the pass keep their positions at the front of it.
+		while (job->phase == transition_job_t::PROPAGATE)
 		{
-			do
+			if (job->position >= job->initial_transformed_count || job->num_random_propagated >= job->propagate_count)
 			{
-				index = rng(0, boundary_tracker.transformed_boundary_count);
-			} while (propagate_indices.find(index) != propagate_indices.end());
-			propagate_indices.insert(index);
-		}
+				job->phase = F::potential_energy ? transition_job_t::POTENTIAL_ENERGY : transition_job_t::IDLE;
+				job->position = 0;
+				break;
+			}
+			if (work >= budget) return false;
 
-		size_t num_random_propagated = 0, num_random_flipped = 0, num_poteng_propagated = 0;
+			size_t i = job->position++;
+			boundary_tracker.swap_transformed(i, i + random_index(job->initial_transformed_count - i));
+			boundary_t *boundary = (*transformed_pool)[i];
+
+			std::vector<boundary_t *> *candidates = &transition_candidates;
+			candidates->clear();
+			for (auto junc_iter = boundary->junctions.begin(); junc_iter != boundary->junctions.end(); ++junc_iter)
+			{
+				if (!junc_iter->first->transformed) candidates->push_back(junc_iter->first);
+			}
+			work += boundary->junctions.size() + 1;
 
-		bool end_loop = false;
-		std::set<size_t>::iterator flip_iter = flip_indices.begin(), propagate_iter = propagate_indices.begin();
+			// Note that the minimum propagation count is one.
+			size_t prop_num = boundary->junctions.size() * job->propagation_ratio;
+			if (prop_num < 1) prop_num = 1;
 
-		// These count the number of transformed and untransformed boundaries come across so far.
-		size_t untrans_count = 0, trans_count = 0;
+			// Transition random junctions (again via a partial shuffle).
+			for (size_t c = 0; c < candidates->size() && c < prop_num && job->num_random_propagated < job->propagate_count; ++c)
+			{
+				std::swap((*candidates)[c], (*candidates)[c + random_index(candidates->size() - c)]);
+				work += transition_boundary_work<F>((*candidates)[c]);
+				++job->num_random_propagated;
+			}
+		}
 
-		// Iterate over the entire boundary map.
-		for (auto sm_iter = boundary_tracker.boundary_map.begin(); sm_iter != boundary_tracker.boundary_map.end(); ++sm_iter)
+		// Potential energy propagation (boundaries transformed along the way are visited as well, which records their surface area).
+		// Each boundary's untransformed junctions are kept in a min-heap ordered by area, so k transitions cost O(k log n).
+		while (job->phase == transition_job_t::POTENTIAL_ENERGY)
 		{
-			for (auto lg_iter = sm_iter->second.begin(); lg_iter != sm_iter->second.end(); ++lg_iter)
+			if (job->position >= transformed_pool->size())
+			{
+				job->phase = transition_job_t::IDLE;
+				break;
+			}
+			if (work >= budget) return false;
+
+			boundary_t *boundary = (*transformed_pool)[job->position++];
+			++work;
+
+			if (boundary->previous_surface_area != 0)
 			{
-				boundary_t *boundary = lg_iter->second;
-				// If the boundary is transformed, check if we should propagate from it.
-				if (boundary->transformed)
+				boundary->potential_energy += boundary->previous_surface_area - boundary->area();
+				if (boundary->potential_energy < 0)
 				{
-					if (propagate_iter != propagate_indices.end())
-					{
-						if (*propagate_iter == trans_count)
-						{
-							size_t prop_num = boundary->junctions.size() * propagation_ratio;
-							if (propagation_ratio <= 0) prop_num = 1;
-
-							// !!! This does not choose a random junction, but just goes in order.
-							bool found_junc = false;
-							for (auto junc_iter = boundary->junctions.begin(); junc_iter != boundary->junctions.end(); ++junc_iter)
-							{
-								if (!junc_iter->first->transformed)
-								{
-									transition_boundary(junc_iter->first);
-
-									found_junc = true;
-									++num_random_propagated;
-
-									// This is a hack to early-stop propagation. It should be cleaner but I am very tired...
-									if (num_random_propagated >= propagate_count)
-									{
-										propagate_iter = propagate_indices.end();
-										--propagate_iter;
-										break;
-									}
-
-									--prop_num;
-									if(prop_num <= 0) break;
-								}
-							}
-
-							if (!found_junc)
-							{
-								// This could cause problems if trans_count = total transformed boundary count...
-								size_t new_prop_index = trans_count;
-								while (propagate_indices.find(++new_prop_index) != propagate_indices.end());
-								propagate_indices.insert(new_prop_index);
-							}
-
-							++propagate_iter;
-						}
-						++trans_count;
-					}
+					boundary->potential_energy = 0;
+				}
 
-					if (use_potential_energy)
+				// Voxel areas cannot change during a boundary's cascade, so its untransformed junctions only need to be ordered once.
+				// Boundaries without any potential energy can never transition a junction, so they are skipped.
+				if (boundary->potential_energy > 0)
+				{
+					std::vector<boundary_t *> *junction_heap = &transition_candidates;
+					junction_heap->clear();
+					for (auto junc_iter = boundary->junctions.begin(); junc_iter != boundary->junctions.end(); ++junc_iter)
 					{
-						// Potential energy propagation.
-						if (boundary->previous_surface_area != 0)
-						{
-							boundary->potential_energy += boundary->previous_surface_area - boundary->area();
-							if (boundary->potential_energy < 0)
-							{
-								boundary->potential_energy = 0;
-							}
-
-							bool potential_propagation = true;
-							while (potential_propagation)
-							{
-								potential_propagation = false;
-								boundary_t *smallest_junc = nullptr;
-
-								for (auto junc_iter = boundary->junctions.begin(); junc_iter != boundary->junctions.end(); ++junc_iter)
-								{
-									if (!junc_iter->first->transformed)
-									{
-										if (smallest_junc == nullptr || smallest_junc->area() > junc_iter->first->area()) smallest_junc = junc_iter->first;
-									}
-								}
-
-								if (smallest_junc != nullptr && smallest_junc->area() <= boundary->potential_energy)
-								{
-									transition_boundary(smallest_junc);
-									boundary->potential_energy -= smallest_junc->area();
-									potential_propagation = true;
-									++num_poteng_propagated;
-								}
-							}
-						}
-						boundary->previous_surface_area = boundary->area();
+						if (!junc_iter->first->transformed) junction_heap->push_back(junc_iter->first);
 					}
-				}
-				// If the boundary is untransformed, check if we should flip it.
-				else if (!boundary->transformed && flip_iter != flip_indices.end())
-				{
-					if (*flip_iter == untrans_count)
+					std::make_heap(junction_heap->begin(), junction_heap->end(), larger_boundary);
+					work += boundary->junctions.size();
+
+					// Transition the smallest untransformed junctions until the potential energy runs out.
+					while (!junction_heap->empty())
 					{
-						transition_boundary(boundary);
+						boundary_t *smallest_junc = junction_heap->front();
+						if (smallest_junc->area() > boundary->potential_energy) break;
 
-						++num_random_flipped;
-						++flip_iter;
+						std::pop_heap(junction_heap->begin(), junction_heap->end(), larger_boundary);
+						junction_heap->pop_back();
+
+						// Junctions are unique, but skip anything that has been transformed in the meantime all the same.
+						if (smallest_junc->transformed) continue;
+
+						work += transition_boundary_work<F>(smallest_junc);
+						boundary->potential_energy -= smallest_junc->area();
+						++job->num_poteng_propagated;
 					}
-					++untrans_count;
-				}
-				// If we have exhausted the flip and propagate lists, end the loop.
-				else if (flip_iter == flip_indices.end() && propagate_iter == propagate_indices.end())
-				{
-					end_loop = true;
-					break;
 				}
 			}
-			if (end_loop) break;
+			boundary->previous_surface_area = boundary->area();
 		}
 
 		std::cout << "Transitioned boundaries: " << boundary_tracker.transformed_boundary_count << " / " << boundary_tracker.total_boundary_count << " boundaries..." << std::endl;
-		std::cout << "# Transitioned via propagation: " << num_random_propagated << ", via random flipping: " << num_random_flipped << ", via potential energy: " << num_poteng_propagated << "..." << std::endl;
+		std::cout << "# Transitioned via propagation: " << job->num_random_propagated << ", via random flipping: " << job->num_random_flipped << ", via potential energy: " << job->num_poteng_propagated << "..." << std::endl;
+		boundary_tracker.print_pool_stats();
+
+		return true;
+	}
+
+public:
+	// The maximum amount of transition work (in voxels and boundaries touched) to perform per step while a pass is pending.
+	// A budget of zero runs every pass all at once.
+	size_t transition_step_budget = 0;
+
+	// Begin a pass that transitions a certain number of random grain boundaries.
+	// Cleanup and target counts are resolved immediately; the rest of the work is done by finish_transitions() or by subsequent steps.
+	void begin_transitions(size_t count, double propagation_chance, double propagation_ratio)
+	{
+		// A new pass can only begin once the previous one is done.
+		finish_transitions();
+
+		std::cout << "Transitioning " << count << " boundaries..." << std::endl;
+
+		boundary_tracker.remove_bad_boundaries();
+
+		size_t untransformed_count = boundary_tracker.untransformed_pool.size(), transformed_count = boundary_tracker.transformed_pool.size();
+		if (count > untransformed_count)
+		{
+			count = untransformed_count;
+		}
+
+		size_t
+			propagate_count = count * propagation_chance,
+			flip_count = count - propagate_count;
+
+		if (transformed_count < propagate_count)
+		{
+			propagate_count = transformed_count;
+			flip_count = count - propagate_count;
+		}
+
+		transition_job = transition_job_t();
+		transition_job.phase = transition_job_t::FLIP;
+		transition_job.propagation_ratio = propagation_ratio;
+		transition_job.flip_count = flip_count;
+		transition_job.propagate_count = propagate_count;
+		transition_job.initial_transformed_count = transformed_count;
+	}
+
+	// Run the pending transition pass (if any) to completion.
+	void finish_transitions()
+	{
+		if (transition_job.phase != transition_job_t::IDLE) (this->*transition_fn)((size_t)-1);
+	}
+
+	// Check if a transition pass is still pending.
+	bool transitions_pending()
+	{
+		return transition_job.phase != transition_job_t::IDLE;
 	}
 };
\ No newline at end of file
@@ -0,0 +1,25 @@
+#pragma once
+
+// A compile-time set of optional lattice features. The lattice engine is instantiated once per feature set (see lattice_t::use_features()),
+// so that disabled features cost nothing within the flip loop.
+template <bool TRANSITIONS, bool POTENTIAL_ENERGY, bool ANALYSIS, bool JUNCTIONS, bool FACE_COUNTS>
+struct lattice_features_t
+{
+	// Boundaries can be transformed (requires per-boundary voxel sets and mobility lookups).
+	static const bool transitions = TRANSITIONS;
+	// The "sweeping"/"potential energy" system is used while transitioning.
+	static const bool potential_energy = POTENTIAL_ENERGY;
+	// The statistics used by the analysis files (flips, surface areas and curvature outies between each pair of grains) are kept up to date.
+	static const bool analysis = ANALYSIS;
+	// Boundaries keep track of their adjacent boundaries (used by propagation, potential energy and the analysis files).
+	static const bool junctions = JUNCTIONS;
+	// The faces shared by each pair of grains are counted (used by telemetry and live exports). The analysis statistics already
+	// hold the surface areas, so this is only needed without them.
+	static const bool face_counts = FACE_COUNTS && !ANALYSIS;
+
+	// Whether or not the boundary tracker needs to be kept up to date at all.
+	static const bool boundary_tracking = TRANSITIONS || JUNCTIONS;
+};
+
+// The feature set with everything enabled (the default).
+typedef lattice_features_t<true, true, true, true, true> all_lattice_features_t;
\ No newline at end of file
@@ -0,0 +1,285 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <atomic>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "lattice.h"
+#include "spin_field.h"
+#include "parallel.h"
+#include "types.h"
+
+/*
+
+A live view of the lattice in a POSIX shared-memory segment, which external viewers and analyzers can read at any rate without
+touching the filesystem or stalling the simulation. All values are in the native byte order.
+
+	segment header (64 bytes)
+		char[8]		magic ("GRAINLV1")
+		uint32		side length
+		uint32		bytes per grain ID (always 4)
+		uint64		voxel count
+		uint64		frame stride (the distance between the two frames, in bytes)
+		uint64		generation (atomic; the number of frames published so far)
+	frame 0, frame 1 (at 64 + n * frame stride)
+		uint64		sequence (atomic; odd while the frame is being written)
+		double		timestep
+		uint64		flips
+		double		boundary energy
+		uint64		grain count
+		double		mean grain volume
+		uint64		boundary count (the number of grain pairs that share at least one face)
+		double		system activity
+		uint32[]	the original grain IDs in lattice order
+
+Frames are double-buffered: frame (generation % 2) holds the latest state, and the next one is written into the other frame.
+Each frame is also guarded by its own sequence lock, so a reader that is still copying a frame when the writer comes back around
+to it notices and retries (see live_reader_t). The writer never waits for readers.
+
+*/
+struct live_counters_t
+{
+	double timestep;
+	uint64_t flips;
+	double energy;
+	uint64_t grains;
+	double mean_grain_volume;
+	uint64_t boundaries;
+	double activity;
+};
+
+class live_segment
+{
+public:
+	static const size_t HEADER_SIZE = 64, FRAME_HEADER_SIZE = 64;
+
+	static const char *magic()
+	{
+		return "GRAINLV1";
+	}
+
+	struct header_t
+	{
+		char magic[8];
+		uint32_t side_length, spin_bytes;
+		uint64_t voxel_count, frame_stride;
+		std::atomic<uint64_t> generation;
+	};
+	struct frame_header_t
+	{
+		std::atomic<uint64_t> sequence;
+		live_counters_t counters;
+	};
+	static_assert(sizeof(header_t) <= HEADER_SIZE && sizeof(frame_header_t) <= FRAME_HEADER_SIZE, "The live segment headers must fit their slots.");
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "Live segments need lock-free 64-bit atomics.");
+
+	// Get the distance between the two frames of a segment (rounded up to a cache line).
+	static size_t frame_stride(size_t voxel_count)
+	{
+		return (FRAME_HEADER_SIZE + voxel_count * sizeof(uint32_t) + 63) / 64 * 64;
+	}
+};
+
+// Publishes the state of a lattice to a shared-memory segment.
+class live_export_t
+{
+private:
+	std::string name;
+	unsigned char *segment = nullptr;
+	size_t segment_size = 0;
+
+	live_segment::header_t *header()
+	{
+		return reinterpret_cast<live_segment::header_t *>(segment);
+	}
+	live_segment::frame_header_t *frame(uint64_t index)
+	{
+		return reinterpret_cast<live_segment::frame_header_t *>(segment + live_segment::HEADER_SIZE + (index & 1) * header()->frame_stride);
+	}
+
+public:
+	~live_export_t()
+	{
+		close();
+	}
+
+	// Create the segment (replacing any old segment with the same name, e.g. "/grainsim").
+	void open(const std::string &segment_name, coord_t side_length)
+	{
+		name = segment_name;
+		size_t voxel_count = (size_t)side_length * side_length * side_length;
+		size_t stride = live_segment::frame_stride(voxel_count);
+		segment_size = live_segment::HEADER_SIZE + 2 * stride;
+
+#ifdef __linux__
+		shm_unlink(name.c_str());
+		int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+		if (fd < 0 || ftruncate(fd, segment_size) != 0)
+		{
+			std::cout << "Error: Could not create the shared-memory segment " << name << "." << std::endl;
+			exit(0);
+		}
+		void *ptr = mmap(nullptr, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (ptr == MAP_FAILED)
+		{
+			std::cout << "Error: Could not map the shared-memory segment " << name << "." << std::endl;
+			exit(0);
+		}
+		segment = static_cast<unsigned char *>(ptr);
+#else
+		std::cout << "Error: Live export requires POSIX shared memory (Linux)." << std::endl;
+		exit(0);
+#endif
+
+		std::cout << "Publishing the live state to shared memory " << name << std::endl;
+
+		live_segment::header_t *head = new (segment) live_segment::header_t;
+		memcpy(head->magic, live_segment::magic(), 8);
+		head->side_length = side_length;
+		head->spin_bytes = sizeof(uint32_t);
+		head->voxel_count = voxel_count;
+		head->frame_stride = stride;
+		new (frame(0)) live_segment::frame_header_t;
+		new (frame(1)) live_segment::frame_header_t;
+		frame(0)->sequence.store(0, std::memory_order_relaxed);
+		frame(1)->sequence.store(0, std::memory_order_relaxed);
+		head->generation.store(0, std::memory_order_release);
+	}
+
+	// Publish the current state of the lattice (copied straight into the frame that readers are not meant to be using).
+	// The boundary count requires the analysis or face_counts feature.
+	void publish(lattice_t *lattice, double timestep)
+	{
+		if (segment == nullptr) return;
+
+		uint64_t generation = header()->generation.load(std::memory_order_relaxed) + 1;
+		live_segment::frame_header_t *target = frame(generation);
+
+		uint64_t sequence = target->sequence.load(std::memory_order_relaxed);
+		target->sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		target->counters.timestep = timestep;
+		target->counters.flips = lattice->total_flips;
+		target->counters.energy = lattice->boundary_energy;
+		target->counters.grains = lattice->live_grain_count();
+		target->counters.mean_grain_volume = lattice->mean_grain_volume();
+		target->counters.boundaries = lattice->boundary_count();
+		target->counters.activity = lattice->system_activity();
+
+		const size_t CHUNK_SIZE = 1 << 16;
+		size_t voxel_count = header()->voxel_count;
+		uint32_t *spins = reinterpret_cast<uint32_t *>(reinterpret_cast<unsigned char *>(target) + live_segment::FRAME_HEADER_SIZE);
+		parallel_for((voxel_count + CHUNK_SIZE - 1) / CHUNK_SIZE, [=](size_t chunk)
+		{
+			size_t end = std::min(voxel_count, (chunk + 1) * CHUNK_SIZE);
+			for (size_t i = chunk * CHUNK_SIZE; i < end; ++i)
+			{
+				spins[i] = lattice->original_spin(lattice->voxels[i].spin);
+			}
+		});
+
+		target->sequence.store(sequence + 2, std::memory_order_release);
+		header()->generation.store(generation, std::memory_order_release);
+	}
+
+	// Unmap and remove the segment (readers that still have it mapped keep their view of the last frame).
+	void close()
+	{
+#ifdef __linux__
+		if (segment == nullptr) return;
+		munmap(segment, segment_size);
+		shm_unlink(name.c_str());
+		segment = nullptr;
+#endif
+	}
+};
+
+// Reads consistent frames from a live segment (this is what an external viewer would do).
+class live_reader_t
+{
+private:
+	const unsigned char *segment = nullptr;
+	size_t segment_size = 0;
+
+	const live_segment::header_t *header() const
+	{
+		return reinterpret_cast<const live_segment::header_t *>(segment);
+	}
+
+public:
+	live_reader_t(const std::string &name)
+	{
+#ifdef __linux__
+		int fd = shm_open(name.c_str(), O_RDONLY, 0);
+		struct stat info;
+		if (fd < 0 || fstat(fd, &info) != 0)
+		{
+			std::cout << "Error: Could not open the shared-memory segment " << name << "." << std::endl;
+			exit(0);
+		}
+		segment_size = info.st_size;
+		void *ptr = segment_size >= live_segment::HEADER_SIZE ? mmap(nullptr, segment_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+		::close(fd);
+		if (ptr == MAP_FAILED)
+		{
+			std::cout << "Error: Could not map the shared-memory segment " << name << "." << std::endl;
+			exit(0);
+		}
+		segment = static_cast<const unsigned char *>(ptr);
+#else
+		std::cout << "Error: Live export requires POSIX shared memory (Linux)." << std::endl;
+		exit(0);
+#endif
+
+		if (memcmp(header()->magic, live_segment::magic(), 8) != 0 || header()->spin_bytes != sizeof(uint32_t)
+			|| segment_size < live_segment::HEADER_SIZE + 2 * header()->frame_stride)
+		{
+			std::cout << "Error: " << name << " is not a grainsim live segment." << std::endl;
+			exit(0);
+		}
+	}
+	~live_reader_t()
+	{
+#ifdef __linux__
+		munmap(const_cast<unsigned char *>(segment), segment_size);
+#endif
+	}
+
+	live_reader_t(const live_reader_t &) = delete;
+	live_reader_t &operator=(const live_reader_t &) = delete;
+
+	// Copy the latest frame (retrying until the copy is consistent). Returns the generation of the frame (0 if nothing has been published yet).
+	uint64_t read(live_counters_t *counters, spin_field_t *field) const
+	{
+		field->side_length = header()->side_length;
+		field->spins.resize(header()->voxel_count);
+
+		while (true)
+		{
+			uint64_t generation = header()->generation.load(std::memory_order_acquire);
+			const unsigned char *frame = segment + live_segment::HEADER_SIZE + (generation & 1) * header()->frame_stride;
+			const live_segment::frame_header_t *frame_header = reinterpret_cast<const live_segment::frame_header_t *>(frame);
+
+			uint64_t sequence = frame_header->sequence.load(std::memory_order_acquire);
+			if (sequence & 1) continue;
+
+			*counters = frame_header->counters;
+			memcpy(field->spins.data(), frame + live_segment::FRAME_HEADER_SIZE, field->spins.size() * sizeof(uint32_t));
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (frame_header->sequence.load(std::memory_order_relaxed) == sequence) return generation;
+		}
+	}
+};
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <vector>
 #include <sstream>
 #include <iomanip>
+#include <csignal>
 
 #include "vtk.h"
 #include "lattice.h"
@@ -12,21 +13,192 @@
 #include "debug_timer.h"
 #include "config.h"
 #include "analysis.h"
+#include "telemetry.h"
+#include "stop_conditions.h"
+#include "events.h"
+#include "restart_io.h"
+#include "output_pipeline.h"
+#include "spin_field.h"
+#include "trajectory.h"
+#include "monitor.h"
+#include "live_export.h"
+
+// Select the cheapest lattice instantiation for a set of features.
+// Each overload resolves one runtime flag into a template argument and passes the rest along.
+template <bool T, bool P, bool A, bool J>
+void use_lattice_features(lattice_t *cube, bool face_counts)
+{
+	// Analysis already counts the faces, so it shares a single instantiation either way.
+	if (face_counts) cube->use_features<lattice_features_t<T, P, A, J, !A> >();
+	else cube->use_features<lattice_features_t<T, P, A, J, false> >();
+}
+template <bool T, bool P, bool A>
+void use_lattice_features(lattice_t *cube, bool junctions, bool face_counts)
+{
+	if (junctions) use_lattice_features<T, P, A, true>(cube, face_counts);
+	else use_lattice_features<T, P, A, false>(cube, face_counts);
+}
+template <bool T, bool P>
+void use_lattice_features(lattice_t *cube, bool analysis, bool junctions, bool face_counts)
+{
+	if (analysis) use_lattice_features<T, P, true>(cube, junctions, face_counts);
+	else use_lattice_features<T, P, false>(cube, junctions, face_counts);
+}
+template <bool T>
+void use_lattice_features(lattice_t *cube, bool potential_energy, bool analysis, bool junctions, bool face_counts)
+{
+	if (potential_energy) use_lattice_features<T, true>(cube, analysis, junctions, face_counts);
+	else use_lattice_features<T, false>(cube, analysis, junctions, face_counts);
+}
+void use_lattice_features(lattice_t *cube, bool transitions, bool potential_energy, bool analysis, bool junctions, bool face_counts)
+{
+	if (transitions) use_lattice_features<true>(cube, potential_energy, analysis, junctions, face_counts);
+	else use_lattice_features<false>(cube, potential_energy, analysis, junctions, face_counts);
+}
+
+// The signal that requested a restart file (SIGTERM also ends the run, SIGUSR1 keeps it going).
+volatile std::sig_atomic_t restart_signal = 0;
+void handle_restart_signal(int signum)
+{
+	restart_signal = signum;
+}
 
 // cd C:\Stuff\School\summer 2023\grainsim
 // g++ -O3 CPPGrainSim/main.cpp -o grainsim.out -static
 
 int main(int argc, char *argv[])
 {
+	// Convert a lattice file into another format (chosen by the output extension), e.g. a .ph or .vtk state into a raw .gsr file.
+	if (argc >= 2 && std::string(argv[1]) == "--convert")
+	{
+		if (argc != 4)
+		{
+			std::cout << "Usage: " << argv[0] << " --convert <input file> <output file>" << std::endl;
+			exit(0);
+		}
+
+		vtk::format_t format = vtk::format_of(argv[3]);
+		lattice_t *lattice = vtk::from_file(argv[2], false);
+		vtk::to_file(argv[3], lattice, format);
+		delete lattice;
+		return 0;
+	}
+
+	// Reconstruct the lattice at a timestep from a recorded trajectory, and write it to a file (in the format of its extension).
+	if (argc >= 2 && std::string(argv[1]) == "--replay")
+	{
+		if (argc != 5)
+		{
+			std::cout << "Usage: " << argv[0] << " --replay <trajectory file> <timestep> <output file>" << std::endl;
+			exit(0);
+		}
+
+		vtk::format_t format = vtk::format_of(argv[4]);
+		double replay_timestep = std::stod(argv[3]);
+		spin_field_t field;
+		trajectory::replay_stats_t stats = trajectory::replay(argv[2], replay_timestep, &field);
+		std::cout << "Replayed " << stats.flips << " flips and " << stats.transitions << " transitions from the keyframe at T = " << stats.keyframe_time << std::endl;
+		vtk::to_file(argv[4], field, format);
+		return 0;
+	}
+
+	// Read the latest state from a running simulation's live segment, and write it to a file (in the format of its extension).
+	if (argc >= 2 && std::string(argv[1]) == "--live")
+	{
+		if (argc != 4)
+		{
+			std::cout << "Usage: " << argv[0] << " --live <segment name> <output file>" << std::endl;
+			exit(0);
+		}
+
+		vtk::format_t format = vtk::format_of(argv[3]);
+		live_reader_t reader(argv[2]);
+		live_counters_t counters;
+		spin_field_t field;
+		uint64_t generation = reader.read(&counters, &field);
+		std::cout << "Frame " << generation << ": T = " << counters.timestep << ", Flips = " << counters.flips << ", Energy = " << counters.energy << ", Grains = " << counters.grains
+				  << ", Mean volume = " << counters.mean_grain_volume << ", Boundaries = " << counters.boundaries << ", A = " << counters.activity << std::endl;
+		vtk::to_file(argv[3], field, format);
+		return 0;
+	}
+
 	// Load the config file.
 	config_t cfg;
 	cfg.load_config();
 
-	// Create the lattice from file.
+	// Set up how the large lattice arrays are allocated.
+	page_alloc_config_t *alloc_cfg = &page_alloc_config();
+	if (cfg.huge_pages == "transparent") alloc_cfg->huge_pages = HUGE_PAGES_TRANSPARENT;
+	else if (cfg.huge_pages == "explicit") alloc_cfg->huge_pages = HUGE_PAGES_EXPLICIT;
+	else if (cfg.huge_pages != "none")
+	{
+		std::cout << "Error: Unknown HUGE_PAGES mode \"" << cfg.huge_pages << "\"." << std::endl;
+		exit(0);
+	}
+	if (cfg.numa_policy == "interleave") alloc_cfg->numa_policy = NUMA_INTERLEAVE;
+	else if (cfg.numa_policy == "bind") alloc_cfg->numa_policy = NUMA_BIND;
+	else if (cfg.numa_policy != "default")
+	{
+		std::cout << "Error: Unknown NUMA_POLICY \"" << cfg.numa_policy << "\"." << std::endl;
+		exit(0);
+	}
+	if (cfg.numa_node < 0 || cfg.numa_node >= 64)
+	{
+		std::cout << "Error: NUMA_NODE must be between 0 and 63." << std::endl;
+		exit(0);
+	}
+	alloc_cfg->numa_node = cfg.numa_node;
+	// The single-threaded simulation is the only user of the arrays, so by default it first-touches them itself. An explicit policy
+	// places the pages regardless of which thread touches them, so the work can then be spread over every hardware thread.
+	if (cfg.first_touch_threads >= 0) alloc_cfg->touch_threads = cfg.first_touch_threads;
+	else alloc_cfg->touch_threads = alloc_cfg->numa_policy == NUMA_DEFAULT ? 1 : 0;
+
+	// The format that checkpoints are written in.
+	vtk::format_t output_format = vtk::FORMAT_ASCII;
+	if (cfg.output_format == "binary") output_format = vtk::FORMAT_BINARY;
+	else if (cfg.output_format == "vti") output_format = vtk::FORMAT_XML;
+	else if (cfg.output_format == "snapshot") output_format = vtk::FORMAT_SNAPSHOT;
+	else if (cfg.output_format == "raw") output_format = vtk::FORMAT_RAW;
+	else if (cfg.output_format != "ascii")
+	{
+		std::cout << "Error: Unknown OUTPUT_FORMAT \"" << cfg.output_format << "\"." << std::endl;
+		exit(0);
+	}
+
+	// The formats that analysis files are written in (text files per checkpoint and/or one binary archive per run).
+	bool analysis_text = cfg.analysis_format == "text" || cfg.analysis_format == "both";
+	bool analysis_binary = cfg.analysis_format == "binary" || cfg.analysis_format == "both";
+	if (!analysis_text && !analysis_binary)
+	{
+		std::cout << "Error: Unknown ANALYSIS_FORMAT \"" << cfg.analysis_format << "\"." << std::endl;
+		exit(0);
+	}
+
+	if (cfg.snapshot_brick_size <= 0)
+	{
+		std::cout << "Error: SNAPSHOT_BRICK_SIZE must be positive." << std::endl;
+		exit(0);
+	}
+
+	// The flip probabilities are Boltzmann factors exp(-dE / kT), which are meaningless for kT <= 0.
+	if (!(cfg.kT > 0))
+	{
+		std::cout << "Error: KT must be positive." << std::endl;
+		exit(0);
+	}
+
+	// Create the lattice from file (or from a restart file, which also holds the state of the run itself).
 	lattice_t *cube;
+	restart_reader_t *resume = nullptr;
 
+	if (!cfg.resume_file.empty())
+	{
+		std::cout << "Resuming from restart file " << cfg.resume_file << std::endl;
+		resume = new restart_reader_t(cfg.resume_file);
+		cube = lattice_t::from_restart(resume);
+	}
 	// If the scale multiplier is not 1, scale the lattice.
-	if (cfg.scale_multiplier != 1)
+	else if (cfg.scale_multiplier != 1)
 	{
 		lattice_t *temp = vtk::from_file(cfg.initial_state_path.c_str(), false);
 		cube = vtk::scale_lattice(temp, cfg.scale_multiplier, false);
@@ -37,12 +209,85 @@ int main(int argc, char *argv[])
 		cube = vtk::from_file(cfg.initial_state_path.c_str(), false);
 	}
 
-	lattice_analyzer_t analyze;
+	// Set up the boundary class tables (the explicit class lists take precedence over the default/transitioned mobilities).
+	std::vector<double> class_mobilities, class_energies;
+	cfg.list_to_vector(cfg.class_mobilities, &class_mobilities);
+	cfg.list_to_vector(cfg.class_energies, &class_energies);
+	if (class_mobilities.size() > lattice_t::MAX_BOUNDARY_CLASSES || class_energies.size() > lattice_t::MAX_BOUNDARY_CLASSES
+		|| cfg.transitioned_class >= lattice_t::MAX_BOUNDARY_CLASSES)
+	{
+		std::cout << "Error: At most " << (int)lattice_t::MAX_BOUNDARY_CLASSES << " boundary classes are supported." << std::endl;
+		exit(0);
+	}
+	// Class 0 holds every untransformed boundary, so transformed boundaries need a class of their own.
+	if (cfg.transitioned_class < 1)
+	{
+		std::cout << "Error: TRANSITIONED_CLASS must be at least 1." << std::endl;
+		exit(0);
+	}
 
-	cube->default_mobility = cfg.default_mobility;
-	cube->transitioned_mobility = cfg.transitioned_mobility;
-	cube->grain_count = cfg.const_grain_count;
-	cube->init();
+	// Classes that are not listed explicitly move at the default mobility.
+	for (unsigned char c = 0; c < lattice_t::MAX_BOUNDARY_CLASSES; ++c) cube->class_mobility[c] = cfg.default_mobility;
+	cube->class_mobility[cfg.transitioned_class] = cfg.transitioned_mobility;
+	for (size_t c = 0; c < class_mobilities.size(); ++c) cube->class_mobility[c] = class_mobilities[c];
+	for (size_t c = 0; c < class_energies.size(); ++c) cube->class_energy[c] = class_energies[c];
+	cube->transitioned_class = cfg.transitioned_class;
+	cube->kT = cfg.kT;
+	cube->transition_step_budget = cfg.transition_step_budget;
+	if (resume == nullptr) cube->grain_count = cfg.const_grain_count;
+
+	// Only pay for the transformation machinery (and analysis bookkeeping) when the config actually uses it.
+	bool transitions = cfg.transition_count > 0;
+	bool potential_energy = transitions && cfg.use_potential_energy;
+	bool analysis = cfg.generate_analysis_files;
+	bool junctions = cfg.generate_analysis_files || potential_energy || (transitions && cfg.propagation_chance > 0);
+	// Telemetry and live exports report the number of face-sharing grain pairs.
+	bool face_counts = cfg.telemetry_interval > 0 || !cfg.live_export_name.empty();
+	use_lattice_features(cube, transitions, potential_energy, analysis, junctions, face_counts);
+
+	if (resume != nullptr) cube->resume();
+	else cube->init();
+
+	// Check the monitoring outputs (crops, downsampled lattices and slices).
+	coord_t roi_x = 0, roi_y = 0, roi_z = 0;
+	if (!(std::istringstream(cfg.roi_origin) >> roi_x >> roi_y >> roi_z))
+	{
+		std::cout << "Error: ROI_ORIGIN must hold three coordinates." << std::endl;
+		exit(0);
+	}
+	if (cfg.roi_interval > 0 && (cfg.roi_size <= 0 || cfg.roi_size > cube->side_length))
+	{
+		std::cout << "Error: ROI_SIZE must be between 1 and the side length of the lattice." << std::endl;
+		exit(0);
+	}
+	// The crop wraps around the far edges, but lattice_t::voxel_at() only wraps coordinates that are at most one side length out.
+	if (cfg.roi_interval > 0 && (roi_x < 0 || roi_y < 0 || roi_z < 0 || roi_x >= cube->side_length || roi_y >= cube->side_length || roi_z >= cube->side_length))
+	{
+		std::cout << "Error: ROI_ORIGIN must be within the lattice." << std::endl;
+		exit(0);
+	}
+	if (cfg.downsample_interval > 0 && (cfg.downsample_factor <= 0 || (cfg.downsample_mode != "stride" && cfg.downsample_mode != "majority")))
+	{
+		std::cout << "Error: DOWNSAMPLE_FACTOR must be positive, and DOWNSAMPLE_MODE must be stride or majority." << std::endl;
+		exit(0);
+	}
+	std::string slice_axes;
+	std::istringstream slice_axes_ss(cfg.slice_axes);
+	for (std::string axis; slice_axes_ss >> axis;)
+	{
+		if (axis != "x" && axis != "y" && axis != "z")
+		{
+			std::cout << "Error: Unknown slice axis \"" << axis << "\"." << std::endl;
+			exit(0);
+		}
+		slice_axes += axis;
+	}
+	coord_t slice_index = cfg.slice_index < 0 ? cube->side_length / 2 : cfg.slice_index;
+	if (cfg.slice_interval > 0 && (slice_index >= cube->side_length || (cfg.slice_format != "ppm" && cfg.slice_format != "pgm")))
+	{
+		std::cout << "Error: SLICE_INDEX must be within the lattice, and SLICE_FORMAT must be ppm or pgm." << std::endl;
+		exit(0);
+	}
 
 	// Generate the checkpoint list.
 	std::vector<double> checkpoints;
@@ -50,93 +295,355 @@ int main(int argc, char *argv[])
 	{
 		cfg.checkpoints_to_vector(&checkpoints);
 	}
-	unsigned char curr_checkpoint = 0;
+	size_t curr_checkpoint = 0;
 
 	// Start global timer.
 	debug_timer_t timer;
 	timer.start();
 
-	double timestep = 0, curr_step, log_duration = 0, transition_duration = 0, next_checkpoint = cfg.checkpoint_interval;
+	double timestep = 0, next_checkpoint = cfg.checkpoint_interval, next_telemetry = 0, last_output = -1;
 	int vtkcount = 0;
 
-	if (cfg.log_transitions) cube->begin_logging_transitions(cfg.output_folder);
+	// Snapshots after the first are stored as deltas against the last keyframe.
+	snapshot_writer_t snapshots(cfg.snapshot_keyframe_interval, cfg.snapshot_brick_size);
 
-	// Main simulation loop.
-	while (true)
-	{
-		// Flip a voxel and store elapsed timesteps.
-		curr_step = cube->step();
-
-		// Update current timestep.
-		timestep += curr_step;
-		log_duration += curr_step;
-		transition_duration += curr_step;
+	// Checkpoints, analysis files and the transition log are written by background writers.
+	output_pipeline_t pipeline(cfg.output_threads, cfg.output_queue_size);
+	output_pipeline_t::lane_t log_lane, archive_lane;
+	analysis_archive_t analysis_archive;
+	bool write_archive = cfg.generate_analysis_files && analysis_binary;
 
-		// Debug logging.
-		if (log_duration >= 20000)
+	// Write a VTK file (and an analysis file, if enabled) for the current state.
+	// Only copying out the data happens here, and the simulation carries on while the files are written.
+	auto write_output = [&](double output_timestep)
+	{
+		std::stringstream ss;
+		ss << cfg.output_folder << cfg.identifier << "_" << std::setw(4) << std::setfill('0') << std::to_string(vtkcount + 1) << '_' << std::to_string((size_t)output_timestep) << vtk::extension(output_format);
+		std::string fname = ss.str();
+		// File names only hold the whole timestep, so the exact time is printed for replaying the checkpoint from the trajectory.
+		if (cfg.record_trajectory)
 		{
-			std::cout << "T = " << timestep << ", dT = " << curr_step << ", A = " << cube->system_activity() << ", Flips = " << cube->total_flips << ", tFlips = " << cube->transformed_flips << ", dTime = " << timer.lap() << " sec, tTime = " << timer.total() << " sec" << std::endl;
-			log_duration = 0;
+			std::ostringstream exact_time;
+			exact_time << std::setprecision(17) << output_timestep;
+			std::cout << "Checkpoint " << fname << " is at T = " << exact_time.str() << std::endl;
 		}
-
-		// Transition some boundaries if applicable.
-		if (transition_duration >= cfg.transition_interval && cfg.transition_count > 0)
+		if (output_format == vtk::FORMAT_SNAPSHOT)
 		{
-			if (cfg.log_transitions) cube->set_log_timestep(timestep);
-
-			cube->transition_boundaries(cfg.transition_count, cfg.propagation_chance, cfg.propagation_ratio, cfg.use_potential_energy);
-
-			transition_duration = 0;
+			std::shared_ptr<snapshot_writer_t::frame_t> frame = std::make_shared<snapshot_writer_t::frame_t>(snapshots.prepare(fname.c_str(), spin_field_t(cube)));
+			pipeline.submit([frame]() { frame->write(); });
 		}
-
-		// Check if VTK should be generated.
-		if (checkpoints.size() > 0 && curr_checkpoint < checkpoints.size() && timestep >= checkpoints[curr_checkpoint]) // The current timestep is an explicit checkpoint.
+		else
 		{
-			std::stringstream ss;
-			ss << cfg.output_folder << cfg.identifier << "_" << std::setw(4) << std::setfill('0') << std::to_string(vtkcount + 1) << '_' << std::to_string((size_t)timestep) << ".vtk";
-			vtk::to_vtk(ss.str().c_str(), cube);
-			if (cfg.log_transitions) cube->flush_log_file();
+			std::shared_ptr<spin_field_t> field = std::make_shared<spin_field_t>(cube);
+			vtk::format_t format = output_format;
+			pipeline.submit([fname, field, format]() { vtk::to_file(fname.c_str(), *field, format); });
+		}
+		if (cfg.log_transitions)
+		{
+			std::shared_ptr<std::string> lines = std::make_shared<std::string>(cube->take_transition_log());
+			pipeline.submit([cube, lines]() { cube->write_transition_log(*lines); }, &log_lane);
+		}
 
-			if (cfg.generate_analysis_files)
+		if (cfg.generate_analysis_files)
+		{
+			std::cout << "Beginning analysis..." << std::endl;
+			std::shared_ptr<lattice_analyzer_t> analyzer = std::make_shared<lattice_analyzer_t>();
+			analyzer->load_lattice(cube);
+			if (analysis_text)
 			{
-				std::cout << "Beginning analysis..." << std::endl;
-				analyze.load_lattice(cube);
 				ss.str(std::string());
-				ss << cfg.output_folder << cfg.identifier << "_" << std::setw(4) << std::setfill('0') << std::to_string(vtkcount + 1) << '_' << std::to_string((size_t)timestep) << "_analysis.txt";
-				analyze.save_analysis_to_file(ss.str().c_str());
+				ss << cfg.output_folder << cfg.identifier << "_" << std::setw(4) << std::setfill('0') << std::to_string(vtkcount + 1) << '_' << std::to_string((size_t)output_timestep) << "_analysis.txt";
+				std::string analysis_fname = ss.str();
+				pipeline.submit([analyzer, analysis_fname]() { analyzer->save_analysis_to_file(analysis_fname.c_str()); });
 			}
+			if (analysis_binary)
+			{
+				analysis_archive_t *archive = &analysis_archive;
+				pipeline.submit([analyzer, archive, output_timestep]() { analyzer->save_analysis_to_archive(archive, output_timestep); }, &archive_lane);
+			}
+		}
 
-			++vtkcount;
-			++curr_checkpoint;
+		++vtkcount;
+		last_output = output_timestep;
+	};
 
-			if (cfg.max_timestep <= 0 && curr_checkpoint >= checkpoints.size()) break;
+	// Get the next multiple of a monitoring interval after the current timestep (so that outputs stay on a fixed grid).
+	auto next_multiple = [&](double interval)
+	{
+		return (std::floor(timestep / interval) + 1) * interval;
+	};
+
+	// Get the name of a monitoring output at the current timestep.
+	auto monitor_fname = [&](const std::string &product, const char *extension)
+	{
+		return cfg.output_folder + cfg.identifier + "_" + product + "_" + std::to_string((size_t)timestep) + extension;
+	};
+
+	stop_conditions_t stop;
+	stop.grain_count = cfg.stop_grain_count;
+	stop.mean_grain_volume = cfg.stop_mean_grain_volume;
+	stop.activity = cfg.stop_activity;
+	stop.stall_window = cfg.stop_stall_window;
+	stop.stall_tolerance = cfg.stop_stall_tolerance;
+
+	event_queue_t events;
+	telemetry_log_t telemetry;
+	trajectory_recorder_t trajectory_recorder;
+	live_export_t live_export;
+	std::string restart_path = cfg.restart_file.empty() ? cfg.output_folder + cfg.identifier + "_restart.bin" : cfg.restart_file;
+
+	// Write the complete state of the run to a restart file.
+	auto write_restart = [&]()
+	{
+		std::cout << "Writing restart file " << restart_path << " at T = " << cube->time << std::endl;
+
+		// The restart file records the sizes of the logs, so every queued write has to land first.
+		pipeline.drain();
+
+		restart_writer_t out(restart_path);
+		cube->save_state(&out);
+		out.put(transitions);
+		out.put(potential_energy);
+		out.put(analysis);
+		out.put(junctions);
+		out.put(face_counts);
+		out.put(next_checkpoint);
+		out.put(next_telemetry);
+		out.put(last_output);
+		out.put(vtkcount);
+		out.put<uint64_t>(curr_checkpoint);
+		events.save_state(&out);
+		stop.save_state(&out);
+		snapshots.save_state(&out);
+		// The logs are cut back to these sizes on resume, so that nothing written after the restart file is duplicated.
+		out.put<int64_t>(cfg.telemetry_interval > 0 ? telemetry.offset() : -1);
+		out.put<int64_t>(cfg.log_transitions ? cube->log_file_offset() : -1);
+		out.put<int64_t>(cfg.record_trajectory ? trajectory_recorder.offset() : -1);
+		out.put<int64_t>(write_archive ? analysis_archive.data_offset() : -1);
+		out.put<int64_t>(write_archive ? analysis_archive.index_offset() : -1);
+		out.close();
+	};
+
+	long telemetry_offset = -1, log_offset = -1, trajectory_offset = -1, archive_offset = -1, archive_index_offset = -1;
+	if (resume != nullptr)
+	{
+		if (resume->get<bool>() != transitions || resume->get<bool>() != potential_energy || resume->get<bool>() != analysis || resume->get<bool>() != junctions
+			|| resume->get<bool>() != face_counts)
+		{
+			std::cout << "Error: The config enables different features than the run that wrote the restart file." << std::endl;
+			exit(0);
 		}
-		else if (cfg.checkpoint_interval > 0 && timestep >= next_checkpoint) // The current timestep surpasses the interval threshold.
+		next_checkpoint = resume->get<double>();
+		next_telemetry = resume->get<double>();
+		last_output = resume->get<double>();
+		vtkcount = resume->get<int>();
+		curr_checkpoint = resume->get<uint64_t>();
+		events.load_state(resume);
+		stop.load_state(resume);
+		snapshots.load_state(resume);
+		telemetry_offset = resume->get<int64_t>();
+		log_offset = resume->get<int64_t>();
+		trajectory_offset = resume->get<int64_t>();
+		archive_offset = resume->get<int64_t>();
+		archive_index_offset = resume->get<int64_t>();
+
+		timestep = cube->time;
+
+		// The config may record a trajectory that the original run did not (keyframes scheduled by a run that did are dropped otherwise).
+		if (cfg.record_trajectory && cfg.trajectory_keyframe_interval > 0 && !events.has(EVENT_TRAJECTORY_KEYFRAME))
 		{
-			std::stringstream ss;
-			ss << cfg.output_folder << cfg.identifier << "_" << std::setw(4) << std::setfill('0') << std::to_string(vtkcount + 1) << '_' << std::to_string((size_t)timestep) << ".vtk";
-			vtk::to_vtk(ss.str().c_str(), cube);
-			if (cfg.log_transitions) cube->flush_log_file();
+			events.schedule(timestep + cfg.trajectory_keyframe_interval, EVENT_TRAJECTORY_KEYFRAME);
+		}
+		// Likewise for live exports.
+		if (!cfg.live_export_name.empty() && cfg.live_export_interval > 0 && !events.has(EVENT_LIVE_EXPORT))
+		{
+			events.schedule(next_multiple(cfg.live_export_interval), EVENT_LIVE_EXPORT);
+		}
+		delete resume;
+	}
+	else
+	{
+		// Schedule the first occurrence of each event (repeating events reschedule themselves when dispatched).
+		events.schedule(20000, EVENT_LOG);
+		if (cfg.telemetry_interval > 0) events.schedule(0, EVENT_TELEMETRY);
+		if (cfg.transition_count > 0) events.schedule(cfg.transition_interval, EVENT_TRANSITION);
+		if (!checkpoints.empty()) events.schedule(checkpoints[0], EVENT_CHECKPOINT);
+		if (cfg.checkpoint_interval > 0) events.schedule(next_checkpoint, EVENT_PERIODIC_CHECKPOINT);
+		if (cfg.record_trajectory && cfg.trajectory_keyframe_interval > 0) events.schedule(cfg.trajectory_keyframe_interval, EVENT_TRAJECTORY_KEYFRAME);
+		if (cfg.roi_interval > 0) events.schedule(0, EVENT_ROI);
+		if (cfg.downsample_interval > 0) events.schedule(0, EVENT_DOWNSAMPLE);
+		if (cfg.slice_interval > 0) events.schedule(0, EVENT_SLICE);
+		if (!cfg.live_export_name.empty() && cfg.live_export_interval > 0) events.schedule(next_multiple(cfg.live_export_interval), EVENT_LIVE_EXPORT);
+		if (stop.enabled()) events.schedule(0, EVENT_STOP_CHECK);
+		if (cfg.max_timestep > 0) events.schedule(cfg.max_timestep, EVENT_MAX_TIMESTEP);
+	}
+
+	if (cfg.log_transitions) cube->begin_logging_transitions(cfg.output_folder, log_offset);
+	if (cfg.telemetry_interval > 0) telemetry.open(cfg.output_folder + cfg.identifier + "_telemetry.csv", telemetry_offset);
+	if (write_archive) analysis_archive.open(cfg.output_folder + cfg.identifier + "_analysis.gsa", archive_offset, archive_index_offset);
+	if (cfg.record_trajectory)
+	{
+		trajectory_recorder.open(cfg.output_folder + cfg.identifier + "_trajectory.gst", cube->side_length, cfg.output_queue_size, trajectory_offset);
+		// Replays start from a keyframe, so a new trajectory starts with the initial state.
+		if (trajectory_offset < 0) trajectory_recorder.record_keyframe(spin_field_t(cube).spins, timestep);
+		cube->trajectory = &trajectory_recorder;
+	}
+
+	if (!cfg.live_export_name.empty())
+	{
+		live_export.open(cfg.live_export_name, cube->side_length);
+		live_export.publish(cube, timestep);
+	}
+
+	// Preempted jobs get a restart file instead of losing the run (the flip loop checks the signal flag between flips).
+	std::signal(SIGTERM, handle_restart_signal);
+#ifdef SIGUSR1
+	// SIGUSR1 is POSIX-only (MinGW does not define it).
+	std::signal(SIGUSR1, handle_restart_signal);
+#endif
+	cube->interrupt = &restart_signal;
+
+	// Main simulation loop. Voxels are flipped in a tight loop until the next event is due, and only then are events dispatched.
+	std::vector<event_t> due_events;
+	bool running = true;
+	while (running)
+	{
+		cube->run_until(events.next_time());
+		timestep = cube->time;
 
-			if (cfg.generate_analysis_files)
+		events.pop_due(timestep, &due_events);
+		for (auto event_iter = due_events.begin(); event_iter != due_events.end() && running; ++event_iter)
+		{
+			switch (event_iter->kind)
 			{
-				std::cout << "Beginning analysis..." << std::endl;
-				analyze.load_lattice(cube);
-				ss.str(std::string());
-				ss << cfg.output_folder << cfg.identifier << "_" << std::setw(4) << std::setfill('0') << std::to_string(vtkcount + 1) << '_' << std::to_string((size_t)timestep) << "_analysis.txt";
-				analyze.save_analysis_to_file(ss.str().c_str());
+			case EVENT_LOG: // Debug logging.
+				std::cout << "T = " << timestep << ", dT = " << cube->last_dt << ", A = " << cube->system_activity() << ", Grains = " << cube->live_grain_count() << ", Flips = " << cube->total_flips << ", tFlips = " << cube->transformed_flips << ", dTime = " << timer.lap() << " sec, tTime = " << timer.total() << " sec" << std::endl;
+				if (cfg.telemetry_interval > 0) telemetry.flush();
+				events.schedule(timestep + 20000, EVENT_LOG);
+				break;
+
+			case EVENT_TELEMETRY: // Sample the telemetry time series.
+				telemetry.sample(timestep, cube);
+				next_telemetry += cfg.telemetry_interval;
+				events.schedule(next_telemetry, EVENT_TELEMETRY);
+				break;
+
+			case EVENT_TRANSITION: // Transition some boundaries.
+				// Any work left over from the previous pass is logged under the previous timestep.
+				cube->finish_transitions();
+				if (cfg.log_transitions) cube->set_log_timestep(timestep);
+
+				// With a step budget, the pass is spread over the following steps (all at once otherwise).
+				cube->begin_transitions(cfg.transition_count, cfg.propagation_chance, cfg.propagation_ratio);
+				if (cfg.transition_step_budget == 0) cube->finish_transitions();
+
+				events.schedule(timestep + cfg.transition_interval, EVENT_TRANSITION);
+				break;
+
+			case EVENT_CHECKPOINT: // The current timestep is an explicit checkpoint.
+				write_output(timestep);
+				++curr_checkpoint;
+
+				if (curr_checkpoint < checkpoints.size()) events.schedule(checkpoints[curr_checkpoint], EVENT_CHECKPOINT);
+				else if (cfg.max_timestep <= 0) running = false;
+				break;
+
+			case EVENT_PERIODIC_CHECKPOINT: // The current timestep surpasses the interval threshold.
+				// An explicit checkpoint takes precedence, and the periodic one follows after the next flip.
+				if (last_output == timestep)
+				{
+					events.schedule(next_checkpoint, EVENT_PERIODIC_CHECKPOINT);
+					break;
+				}
+
+				write_output(timestep);
+				next_checkpoint += cfg.checkpoint_interval;
+				events.schedule(next_checkpoint, EVENT_PERIODIC_CHECKPOINT);
+				break;
+
+			case EVENT_TRAJECTORY_KEYFRAME: // Record a keyframe that trajectory replays can start from.
+				// Keyframes left over from a run that recorded a trajectory are dropped when the resumed run does not.
+				if (!cfg.record_trajectory || cfg.trajectory_keyframe_interval <= 0) break;
+				trajectory_recorder.record_keyframe(spin_field_t(cube).spins, timestep);
+				events.schedule(timestep + cfg.trajectory_keyframe_interval, EVENT_TRAJECTORY_KEYFRAME);
+				break;
+
+			case EVENT_ROI: // Write the region of interest.
+			{
+				std::shared_ptr<spin_field_t> field = std::make_shared<spin_field_t>(monitor::crop(cube, roi_x, roi_y, roi_z, cfg.roi_size));
+				std::string fname = monitor_fname("roi", vtk::extension(output_format));
+				vtk::format_t format = output_format;
+				pipeline.submit([fname, field, format]() { vtk::to_file(fname.c_str(), *field, format); });
+				events.schedule(next_multiple(cfg.roi_interval), EVENT_ROI);
+				break;
 			}
 
-			++vtkcount;
+			case EVENT_DOWNSAMPLE: // Write the downsampled lattice.
+			{
+				std::shared_ptr<spin_field_t> field = std::make_shared<spin_field_t>(monitor::downsample(cube, cfg.downsample_factor, cfg.downsample_mode == "majority"));
+				std::string fname = monitor_fname("downsampled", vtk::extension(output_format));
+				vtk::format_t format = output_format;
+				pipeline.submit([fname, field, format]() { vtk::to_file(fname.c_str(), *field, format); });
+				events.schedule(next_multiple(cfg.downsample_interval), EVENT_DOWNSAMPLE);
+				break;
+			}
 
-			next_checkpoint += cfg.checkpoint_interval;
+			case EVENT_SLICE: // Write the slices as images.
+				for (auto axis_iter = slice_axes.begin(); axis_iter != slice_axes.end(); ++axis_iter)
+				{
+					std::shared_ptr<monitor::slice_t> slice = std::make_shared<monitor::slice_t>(monitor::slice(cube, *axis_iter, slice_index));
+					bool color = cfg.slice_format == "ppm";
+					std::string fname = monitor_fname(std::string("slice_") + *axis_iter + std::to_string(slice_index), color ? ".ppm" : ".pgm");
+					pipeline.submit([fname, slice, color]() { monitor::write_image(fname.c_str(), *slice, color); });
+				}
+				events.schedule(next_multiple(cfg.slice_interval), EVENT_SLICE);
+				break;
+
+			case EVENT_LIVE_EXPORT: // Publish the current state to shared memory.
+				// Exports left over from a run that published its state are dropped when the resumed run does not.
+				if (cfg.live_export_name.empty() || cfg.live_export_interval <= 0) break;
+				live_export.publish(cube, timestep);
+				events.schedule(next_multiple(cfg.live_export_interval), EVENT_LIVE_EXPORT);
+				break;
+
+			case EVENT_STOP_CHECK: // Stop early once the microstructure has reached the requested state (always ending on an output).
+			{
+				std::string reason = stop.check(timestep, cube);
+				if (!reason.empty())
+				{
+					std::cout << "Stopping at T = " << timestep << ": " << reason << "." << std::endl;
+					if (last_output != timestep) write_output(timestep);
+					if (cfg.telemetry_interval > 0) telemetry.sample(timestep, cube);
+					running = false;
+				}
+				events.schedule(timestep + cfg.stop_check_interval, EVENT_STOP_CHECK);
+				break;
+			}
+
+			case EVENT_MAX_TIMESTEP: // The max timestep is reached.
+				running = false;
+				break;
+			}
 		}
 
-		// Break if the max timestep is reached.
-		if (cfg.max_timestep > 0 && timestep >= cfg.max_timestep) break;
+		if (restart_signal != 0)
+		{
+			write_restart();
+			if (restart_signal == SIGTERM) running = false;
+			restart_signal = 0;
+		}
 	}
 
+	pipeline.drain();
 	if (cfg.log_transitions) cube->stop_logging_transitions();
+	if (cfg.telemetry_interval > 0) telemetry.close();
+	if (cfg.record_trajectory) trajectory_recorder.close();
+	if (write_archive) analysis_archive.close();
+	if (!cfg.live_export_name.empty())
+	{
+		live_export.publish(cube, timestep);
+		live_export.close();
+	}
 
 
 
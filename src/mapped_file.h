@@ -0,0 +1,83 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <iterator>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// A whole file mapped into memory (read-only), so that it can be parsed in place (and in parallel).
+// Outside of Linux the file is simply read into memory.
+class mapped_file_t
+{
+private:
+	const char *data = nullptr;
+	size_t length = 0;
+	std::vector<char> buffer;
+
+public:
+	mapped_file_t(const char *fname)
+	{
+#ifdef __linux__
+		int fd = open(fname, O_RDONLY);
+		struct stat info;
+		if (fd < 0 || fstat(fd, &info) != 0)
+		{
+			std::cout << "Error: Could not open " << fname << "." << std::endl;
+			exit(0);
+		}
+		length = info.st_size;
+		if (length > 0)
+		{
+			void *ptr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+			if (ptr == MAP_FAILED)
+			{
+				std::cout << "Error: Could not map " << fname << "." << std::endl;
+				exit(0);
+			}
+			madvise(ptr, length, MADV_SEQUENTIAL);
+			data = static_cast<const char *>(ptr);
+		}
+		close(fd);
+#else
+		std::ifstream file(fname, std::ios::binary);
+		if (!file)
+		{
+			std::cout << "Error: Could not open " << fname << "." << std::endl;
+			exit(0);
+		}
+		buffer.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		data = buffer.data();
+		length = buffer.size();
+#endif
+	}
+
+	~mapped_file_t()
+	{
+#ifdef __linux__
+		if (data != nullptr) munmap(const_cast<char *>(data), length);
+#endif
+	}
+
+	mapped_file_t(const mapped_file_t &) = delete;
+	mapped_file_t &operator=(const mapped_file_t &) = delete;
+
+	const char *begin() const
+	{
+		return data;
+	}
+	const char *end() const
+	{
+		return data + length;
+	}
+	size_t size() const
+	{
+		return length;
+	}
+};
\ No newline at end of file
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+
+#include "lattice.h"
+#include "spin_field.h"
+#include "parallel.h"
+#include "types.h"
+
+// Lightweight outputs for watching a run at a much finer time resolution than full checkpoints: a cubic crop of the lattice,
+// a downsampled lattice and 2D slices written as images. Each product is copied out of the lattice on the simulation thread
+// (only the voxels it needs) and can then be written in the background.
+class monitor
+{
+public:
+	// A 2D slice through the lattice, perpendicular to an axis.
+	struct slice_t
+	{
+		char axis;
+		coord_t index;
+		// Rows run along the first of the two remaining axes (in x, y, z order), and there is one row per index along the second.
+		coord_t width, height;
+		// The original grain IDs, row by row.
+		std::vector<uint32_t> spins;
+	};
+
+	// Copy out a cube of the lattice with its corner at (x0, y0, z0) (wrapping around the periodic boundaries).
+	static spin_field_t crop(lattice_t *lattice, coord_t x0, coord_t y0, coord_t z0, coord_t size)
+	{
+		spin_field_t field;
+		field.side_length = size;
+		field.spins.resize((size_t)size * size * size);
+
+		size_t i = 0;
+		for (coord_t z = 0; z < size; ++z)
+			for (coord_t y = 0; y < size; ++y)
+				for (coord_t x = 0; x < size; ++x)
+				{
+					field.spins[i++] = lattice->original_spin(lattice->voxel_at(x0 + x, y0 + y, z0 + z)->spin);
+				}
+
+		return field;
+	}
+
+	// Downsample the lattice by a factor along each axis, either by taking the first voxel of every factor^3 block (strided),
+	// or by taking the most common grain within the block (majority, with ties going to the lowest grain ID). Blocks at the far
+	// edges are clipped.
+	static spin_field_t downsample(lattice_t *lattice, coord_t factor, bool majority)
+	{
+		coord_t side = lattice->side_length, out_side = (side + factor - 1) / factor;
+		spin_field_t field;
+		field.side_length = out_side;
+		field.spins.resize((size_t)out_side * out_side * out_side);
+
+		// Each output layer is independent, so they are filled in parallel.
+		uint32_t *output = field.spins.data();
+		parallel_for(out_side, [=](size_t oz)
+		{
+			std::vector<std::pair<spin_t, size_t> > counts;
+			for (coord_t oy = 0; oy < out_side; ++oy)
+				for (coord_t ox = 0; ox < out_side; ++ox)
+				{
+					coord_t x0 = ox * factor, y0 = oy * factor, z0 = oz * factor;
+					spin_t spin = lattice->voxel_at(x0, y0, z0)->spin;
+
+					if (majority)
+					{
+						counts.clear();
+						for (coord_t z = z0; z < std::min(z0 + factor, side); ++z)
+							for (coord_t y = y0; y < std::min(y0 + factor, side); ++y)
+								for (coord_t x = x0; x < std::min(x0 + factor, side); ++x)
+								{
+									spin_t s = lattice->voxel_at(x, y, z)->spin;
+									auto count_iter = std::find_if(counts.begin(), counts.end(), [s](const std::pair<spin_t, size_t> &c) { return c.first == s; });
+									if (count_iter == counts.end()) counts.push_back(std::make_pair(s, 1));
+									else ++count_iter->second;
+								}
+
+						// Dense spins keep the order of the original IDs, so the lowest spin is also the lowest grain ID.
+						size_t best = 0;
+						for (auto count_iter = counts.begin(); count_iter != counts.end(); ++count_iter)
+						{
+							if (count_iter->second > best || (count_iter->second == best && count_iter->first < spin))
+							{
+								best = count_iter->second;
+								spin = count_iter->first;
+							}
+						}
+					}
+
+					output[ox + (size_t)oy * out_side + oz * out_side * out_side] = lattice->original_spin(spin);
+				}
+		});
+
+		return field;
+	}
+
+	// Copy out the slice perpendicular to an axis ('x', 'y' or 'z') at an index along it.
+	static slice_t slice(lattice_t *lattice, char axis, coord_t index)
+	{
+		slice_t result;
+		result.axis = axis;
+		result.index = index;
+		result.width = result.height = lattice->side_length;
+		result.spins.resize((size_t)result.width * result.height);
+
+		size_t i = 0;
+		for (coord_t v = 0; v < result.height; ++v)
+			for (coord_t u = 0; u < result.width; ++u)
+			{
+				voxel_t *voxel;
+				if (axis == 'x') voxel = lattice->voxel_at(index, u, v);
+				else if (axis == 'y') voxel = lattice->voxel_at(u, index, v);
+				else voxel = lattice->voxel_at(u, v, index);
+				result.spins[i++] = lattice->original_spin(voxel->spin);
+			}
+
+		return result;
+	}
+
+	// Map a grain ID to a well-spread pseudo-random color (grain 0 is black).
+	static uint32_t grain_color(uint32_t spin)
+	{
+		if (spin == 0) return 0;
+
+		uint32_t hash = spin * 2654435761u;
+		hash ^= hash >> 15;
+		hash *= 2246822519u;
+		hash ^= hash >> 13;
+		return hash | 0x202020;
+	}
+
+	// Write a slice as a binary PPM image (one color per grain) or PGM image (one grey level per grain).
+	static void write_image(const char *fname, const slice_t &slice, bool color)
+	{
+		std::ofstream file(fname, std::ios::binary);
+
+		std::cout << "Writing to " << fname << std::endl;
+
+		file << (color ? "P6\n" : "P5\n") << slice.width << ' ' << slice.height << "\n255\n";
+		std::vector<unsigned char> pixels;
+		pixels.reserve(slice.spins.size() * (color ? 3 : 1));
+		for (auto spin_iter = slice.spins.begin(); spin_iter != slice.spins.end(); ++spin_iter)
+		{
+			uint32_t rgb = grain_color(*spin_iter);
+			if (color)
+			{
+				pixels.push_back(rgb >> 16);
+				pixels.push_back(rgb >> 8);
+				pixels.push_back(rgb);
+			}
+			else
+			{
+				pixels.push_back(rgb);
+			}
+		}
+		file.write(reinterpret_cast<const char *>(pixels.data()), pixels.size());
+
+		file.close();
+	}
+};
\ No newline at end of file
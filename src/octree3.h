@@ -2,12 +2,23 @@
 
 #include <cmath>
 #include <iostream>
+#include <vector>
+#include <algorithm>
 
 #include "types.h"
 #include "voxel.h"
+#include "page_alloc.h"
+#include "restart_io.h"
 
 struct octree3_t
 {
+	// A pending activity change for a single voxel (see delta_batch()).
+	struct pending_delta_t
+	{
+		coord_t x, y, z;
+		activ_t dA;
+	};
+
 private:
 	// The length of one side of the area that the octree represents (generally a power of 2).
 	coord_t root_size;
@@ -36,8 +47,30 @@ public:
 			pow_table[i] = (size_t)pow(8, i);
 			activity_count += pow_table[i];
 		}
-		activities = new activ_t[activity_count];
-		for (size_t i = 0; i < activity_count; ++i) activities[i] = 0;
+		// Activities are zero-initialized by page_alloc().
+		activities = page_alloc<activ_t>(activity_count, "activity tree");
+	}
+	~octree3_t()
+	{
+		page_free(activities, activity_count);
+		delete[] pow_table;
+	}
+
+	// Write the activities of all nodes to a restart file.
+	void save_state(restart_writer_t *out)
+	{
+		out->put<uint64_t>(activity_count);
+		out->put_array(activities, activity_count);
+	}
+	// Read the activities written by save_state() (the tree must have the same size).
+	void load_state(restart_reader_t *in)
+	{
+		if (in->get<uint64_t>() != activity_count)
+		{
+			std::cout << "Error: The activity tree within the restart file does not match the lattice." << std::endl;
+			exit(0);
+		}
+		in->get_array(activities, activity_count);
 	}
 
 	// Shift the activity of a certain voxel by the specified amount.
@@ -58,6 +91,49 @@ public:
 		}
 	}
 
+	// Apply a batch of activity changes at once (the deltas are reordered in the process).
+	// Deltas are sorted by leaf so that changes that share an ancestor are merged before moving up a level.
+	void delta_batch(std::vector<pending_delta_t> *deltas)
+	{
+		batch_nodes.clear();
+		for (auto delta_iter = deltas->begin(); delta_iter != deltas->end(); ++delta_iter)
+		{
+			if (delta_iter->dA == 0) continue;
+			batch_nodes.emplace_back(leaf_index(delta_iter->x, delta_iter->y, delta_iter->z), delta_iter->dA);
+		}
+		if (batch_nodes.empty()) return;
+
+		std::sort(batch_nodes.begin(), batch_nodes.end(),
+			[](const std::pair<size_t, activ_t> &a, const std::pair<size_t, activ_t> &b) { return a.first < b.first; });
+
+		size_t rindex = activity_count - pow_table[max_level];
+		for (unsigned char level = max_level; ; --level)
+		{
+			// Merge the deltas that land on the same node, then apply them.
+			size_t merged = 0;
+			for (size_t i = 1; i < batch_nodes.size(); ++i)
+			{
+				if (batch_nodes[i].first == batch_nodes[merged].first) batch_nodes[merged].second += batch_nodes[i].second;
+				else batch_nodes[++merged] = batch_nodes[i];
+			}
+			batch_nodes.resize(merged + 1);
+
+			for (size_t i = 0; i < batch_nodes.size(); ++i)
+			{
+				activities[rindex + batch_nodes[i].first] += batch_nodes[i].second;
+			}
+
+			if (level == 0) break;
+
+			// Move up to the parent nodes (sorted order is preserved).
+			rindex -= pow_table[level - 1];
+			for (size_t i = 0; i < batch_nodes.size(); ++i)
+			{
+				batch_nodes[i].first /= 8;
+			}
+		}
+	}
+
 	// Returns xyz position of the voxel where the sum of all previous voxel activities (when walking the lattice) is equal to rand_activ.
 	// TODO: Try to get rid of voxel_list dependancy.
 	void get_voxel_from_sum_activity(coord_t *x, coord_t *y, coord_t *z, activ_t rand_activ, voxel_t *voxel_list, coord_t true_side_length)
@@ -121,6 +197,21 @@ public:
 
 private:
 
+	// Scratch space for delta_batch() (pairs of level-relative node index and activity delta).
+	std::vector<std::pair<size_t, activ_t> > batch_nodes;
+
+	// Get the index of the leaf node that contains a voxel, relative to the start of the lowest level.
+	// Each level picks one of eight siblings based on the next bit of each coordinate (z is the most significant).
+	size_t leaf_index(coord_t x, coord_t y, coord_t z)
+	{
+		size_t index = 0;
+		for (int bit = max_level - 1; bit >= 0; --bit)
+		{
+			index = (index * 8) + (((z >> bit) & 1) * 4) + (((y >> bit) & 1) * 2) + ((x >> bit) & 1);
+		}
+		return index;
+	}
+
 	// These helper functions are used to navigate through the tree.
 
 	size_t curr_index;
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+// A bounded queue of output jobs (writing checkpoints, analysis files and logs) that are run by a pool of background workers, so that
+// the simulation only pays for copying out the data that a job needs. When the queue is full, submit() blocks until a worker frees up
+// a slot, which keeps the number of buffered copies (and thus the memory used) bounded. With zero workers, jobs run immediately.
+class output_pipeline_t
+{
+public:
+	// Jobs that are submitted to the same lane run one after another, in the order that they were submitted (e.g. appends to the
+	// same file, or snapshot frames that depend on each other). Jobs in different lanes (or without a lane) may run concurrently.
+	struct lane_t
+	{
+		std::shared_future<void> last_job;
+	};
+
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()> > queue;
+	size_t max_queued;
+	// The number of jobs that are queued or running.
+	size_t pending = 0;
+	bool stopping = false;
+
+	std::mutex mutex;
+	std::condition_variable job_ready, slot_free, all_done;
+
+	void work()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			job_ready.wait(lock, [this]() { return stopping || !queue.empty(); });
+			if (queue.empty()) return;
+
+			std::function<void()> job = std::move(queue.front());
+			queue.pop_front();
+			slot_free.notify_one();
+
+			lock.unlock();
+			job();
+			lock.lock();
+
+			if (--pending == 0) all_done.notify_all();
+		}
+	}
+
+public:
+	output_pipeline_t(unsigned worker_count, size_t max_queued) : max_queued(max_queued > 0 ? max_queued : 1)
+	{
+		for (unsigned w = 0; w < worker_count; ++w)
+		{
+			workers.emplace_back(&output_pipeline_t::work, this);
+		}
+	}
+	~output_pipeline_t()
+	{
+		drain();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		job_ready.notify_all();
+		for (auto worker_iter = workers.begin(); worker_iter != workers.end(); ++worker_iter)
+		{
+			worker_iter->join();
+		}
+	}
+
+	// Queue a job (blocks while the queue is full).
+	void submit(std::function<void()> job, lane_t *lane = nullptr)
+	{
+		if (lane != nullptr)
+		{
+			// Jobs are taken from the queue in order, so the previous job in the lane is always running (or done) by the time this one
+			// starts waiting for it.
+			std::shared_ptr<std::promise<void> > done = std::make_shared<std::promise<void> >();
+			std::shared_future<void> previous = lane->last_job;
+			lane->last_job = done->get_future().share();
+			job = [job, previous, done]()
+			{
+				if (previous.valid()) previous.wait();
+				job();
+				done->set_value();
+			};
+		}
+
+		if (workers.empty())
+		{
+			job();
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		slot_free.wait(lock, [this]() { return queue.size() < max_queued; });
+		queue.push_back(std::move(job));
+		++pending;
+		job_ready.notify_one();
+	}
+
+	// Wait until every submitted job has finished.
+	void drain()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		all_done.wait(lock, [this]() { return pending == 0; });
+	}
+};
\ No newline at end of file
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <iostream>
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <new>
+#include <unordered_map>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// How large allocations should be backed by huge pages.
+enum huge_page_mode_t : char
+{
+	HUGE_PAGES_NONE,
+	// Ask the kernel to back the memory with transparent huge pages (madvise).
+	HUGE_PAGES_TRANSPARENT,
+	// Map the memory from the explicit huge page pool (falls back to transparent huge pages if the pool is empty).
+	HUGE_PAGES_EXPLICIT
+};
+
+// How large allocations should be placed across NUMA nodes.
+enum numa_policy_t : char
+{
+	// Pages are placed on the node of the thread that touches them first.
+	NUMA_DEFAULT,
+	// Pages are spread round-robin over all online nodes.
+	NUMA_INTERLEAVE,
+	// Pages are placed on a single node.
+	NUMA_BIND
+};
+
+// Settings for page_alloc() (must be set before the lattice is created).
+struct page_alloc_config_t
+{
+	huge_page_mode_t huge_pages = HUGE_PAGES_NONE;
+	numa_policy_t numa_policy = NUMA_DEFAULT;
+	// The node to use with NUMA_BIND.
+	int numa_node = 0;
+	// The number of threads that initialize ("first-touch") newly allocated memory (0 uses every hardware thread). The default of 1
+	// touches it from the allocating thread, which places the pages on that thread's node under NUMA_DEFAULT.
+	unsigned touch_threads = 1;
+};
+
+inline page_alloc_config_t &page_alloc_config()
+{
+	static page_alloc_config_t config;
+	return config;
+}
+
+namespace page_alloc_detail
+{
+	// The size of a (transparent) huge page on x86-64 and most other 64-bit platforms.
+	static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+	// The length of each mapping made by page_alloc() (needed to unmap it again).
+	inline std::unordered_map<void *, size_t> &mappings()
+	{
+		static std::unordered_map<void *, size_t> *lengths = new std::unordered_map<void *, size_t>();
+		return *lengths;
+	}
+
+#ifdef __linux__
+	// Get a bitmask of the online NUMA nodes (only node 0 if the information is unavailable).
+	inline unsigned long online_nodes()
+	{
+		std::ifstream file("/sys/devices/system/node/online");
+		std::string list;
+		unsigned long mask = 0;
+		if (file >> list)
+		{
+			std::istringstream ss(list);
+			std::string range;
+			while (std::getline(ss, range, ','))
+			{
+				size_t dash = range.find('-');
+				int first = std::stoi(range), last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+				for (int node = first; node <= last && node < 64; ++node) mask |= 1ul << node;
+			}
+		}
+		return mask ? mask : 1ul;
+	}
+
+	// Apply the configured NUMA policy to a mapping (glibc has no mbind() wrapper, so the syscall is made directly).
+	inline void apply_numa_policy(void *ptr, size_t length)
+	{
+		const int MPOL_BIND_MODE = 2, MPOL_INTERLEAVE_MODE = 3;
+		page_alloc_config_t *config = &page_alloc_config();
+		if (config->numa_policy == NUMA_DEFAULT) return;
+
+		unsigned long mask = config->numa_policy == NUMA_BIND ? 1ul << config->numa_node : online_nodes();
+		int mode = config->numa_policy == NUMA_BIND ? MPOL_BIND_MODE : MPOL_INTERLEAVE_MODE;
+		if (syscall(SYS_mbind, ptr, length, mode, &mask, sizeof(mask) * 8, 0) != 0)
+		{
+			std::cout << "Warning: Could not apply the NUMA policy (mbind failed)." << std::endl;
+		}
+	}
+
+	// Map anonymous memory, trying explicit and transparent huge pages as configured (returns nullptr on failure).
+	inline void *map(size_t bytes, size_t *out_length)
+	{
+		page_alloc_config_t *config = &page_alloc_config();
+
+		if (config->huge_pages == HUGE_PAGES_EXPLICIT)
+		{
+			size_t length = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+			void *ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (ptr != MAP_FAILED)
+			{
+				*out_length = length;
+				return ptr;
+			}
+			std::cout << "Warning: No explicit huge pages available, falling back to transparent huge pages." << std::endl;
+		}
+
+		// Over-allocate so that the mapping can be aligned to a huge page boundary (transparent huge pages need aligned 2 MB ranges).
+		size_t length = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+		char *raw = static_cast<char *>(mmap(nullptr, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		if (raw == MAP_FAILED) return nullptr;
+
+		char *ptr = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(raw) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+		if (ptr != raw) munmap(raw, ptr - raw);
+		if (ptr + length != raw + length + HUGE_PAGE_SIZE) munmap(ptr + length, (raw + length + HUGE_PAGE_SIZE) - (ptr + length));
+
+		if (config->huge_pages != HUGE_PAGES_NONE) madvise(ptr, length, MADV_HUGEPAGE);
+
+		*out_length = length;
+		return ptr;
+	}
+
+	// Print the page size that a mapping actually got (read from /proc/self/smaps after it has been touched).
+	inline void report(const char *name, void *ptr, size_t length)
+	{
+		std::ifstream smaps("/proc/self/smaps");
+		std::string line;
+		uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+		bool in_mapping = false;
+		size_t kernel_page_kb = 0, huge_kb = 0;
+
+		while (std::getline(smaps, line))
+		{
+			uintptr_t start, end;
+			if (sscanf(line.c_str(), "%lx-%lx ", &start, &end) == 2 && line.find(':') > line.find(' '))
+			{
+				// Mappings can be split up (e.g. by differing policies), so every part within the range is counted.
+				in_mapping = start >= address && end <= address + length;
+				continue;
+			}
+			if (!in_mapping) continue;
+
+			size_t value;
+			if (sscanf(line.c_str(), "KernelPageSize: %zu kB", &value) == 1) kernel_page_kb = std::max(kernel_page_kb, value);
+			else if (sscanf(line.c_str(), "AnonHugePages: %zu kB", &value) == 1) huge_kb += value;
+		}
+
+		std::cout << "Allocated " << name << " (" << (length >> 20) << " MB): " << kernel_page_kb << " kB pages";
+		if (huge_kb > 0) std::cout << ", " << (huge_kb >> 10) << " MB on transparent huge pages";
+		std::cout << std::endl;
+	}
+#endif
+}
+
+// Allocate and construct an array for a large, long-lived structure (e.g. the voxels or the activity tree).
+// Memory is mapped directly with the configured huge page and NUMA settings, and is constructed ("first-touched") by
+// page_alloc_config().touch_threads threads. Under the default NUMA policy the pages end up on the nodes of the threads that touched them.
+// Outside of Linux this is simply new[].
+template <typename T>
+T *page_alloc(size_t count, const char *name)
+{
+#ifdef __linux__
+	size_t length;
+	void *ptr = page_alloc_detail::map(count * sizeof(T), &length);
+	if (ptr == nullptr)
+	{
+		std::cout << "Error: Could not allocate " << name << "." << std::endl;
+		exit(0);
+	}
+	page_alloc_detail::mappings()[ptr] = length;
+	page_alloc_detail::apply_numa_policy(ptr, length);
+
+	T *array = static_cast<T *>(ptr);
+	auto construct_range = [array](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i) new (&array[i]) T();
+	};
+
+	unsigned thread_count = page_alloc_config().touch_threads;
+	if (thread_count == 0) thread_count = std::max(1u, std::thread::hardware_concurrency());
+	// Small arrays are not worth the threads.
+	if (length < 16 * page_alloc_detail::HUGE_PAGE_SIZE) thread_count = 1;
+
+	std::vector<std::thread> threads;
+	size_t chunk = (count + thread_count - 1) / thread_count;
+	for (unsigned t = 1; t < thread_count; ++t)
+	{
+		threads.emplace_back(construct_range, std::min(count, t * chunk), std::min(count, (t + 1) * chunk));
+	}
+	construct_range(0, std::min(count, chunk));
+	for (auto thread_iter = threads.begin(); thread_iter != threads.end(); ++thread_iter)
+	{
+		thread_iter->join();
+	}
+
+	page_alloc_detail::report(name, ptr, length);
+	return array;
+#else
+	return new T[count];
+#endif
+}
+
+// Destroy and free an array that was allocated by page_alloc().
+template <typename T>
+void page_free(T *array, size_t count)
+{
+	if (array == nullptr) return;
+#ifdef __linux__
+	for (size_t i = 0; i < count; ++i) array[i].~T();
+
+	auto mapping_iter = page_alloc_detail::mappings().find(array);
+	munmap(array, mapping_iter->second);
+	page_alloc_detail::mappings().erase(mapping_iter);
+#else
+	delete[] array;
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+// Run a function over a range of items with one contiguous chunk per hardware thread.
+template <typename FUNC>
+void parallel_for(size_t count, FUNC func)
+{
+	size_t thread_count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), count);
+	if (thread_count <= 1)
+	{
+		for (size_t i = 0; i < count; ++i) func(i);
+		return;
+	}
+
+	std::vector<std::thread> threads;
+	size_t chunk = (count + thread_count - 1) / thread_count;
+	for (size_t t = 0; t < thread_count; ++t)
+	{
+		threads.emplace_back([=]()
+		{
+			for (size_t i = t * chunk; i < std::min(count, (t + 1) * chunk); ++i) func(i);
+		});
+	}
+	for (auto thread_iter = threads.begin(); thread_iter != threads.end(); ++thread_iter)
+	{
+		thread_iter->join();
+	}
+}
\ No newline at end of file
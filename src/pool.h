@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <memory>
+#include <utility>
+
+// Statistics that describe the usage of a memory pool (all values are in blocks).
+struct pool_stats_t
+{
+	size_t live = 0, high_water = 0, capacity = 0;
+};
+
+// A pool of fixed-size memory blocks. Blocks are carved out of large chunks and recycled through a free list, so
+// repeatedly creating and deleting objects of the same size does not touch the system allocator (or fragment the heap).
+// NOTE: Pools are not thread-safe.
+class block_pool_t
+{
+private:
+	// The size of a single block (rounded up so that freed blocks can hold the free list pointer).
+	size_t block_size;
+	// The number of blocks within each chunk.
+	size_t blocks_per_chunk;
+	// All chunks that have been allocated so far.
+	std::vector<char *> chunks;
+	// A singly-linked list of blocks that are ready to be reused.
+	void *free_list;
+
+	pool_stats_t stats;
+
+	// Allocate a new chunk and push all of its blocks onto the free list.
+	void grow()
+	{
+		char *chunk = static_cast<char *>(::operator new(block_size * blocks_per_chunk));
+		chunks.push_back(chunk);
+
+		for (size_t i = blocks_per_chunk; i > 0; --i)
+		{
+			void *block = chunk + ((i - 1) * block_size);
+			*static_cast<void **>(block) = free_list;
+			free_list = block;
+		}
+		stats.capacity += blocks_per_chunk;
+	}
+
+public:
+	block_pool_t(size_t size, size_t chunk_blocks = 4096)
+	{
+		block_size = size < sizeof(void *) ? sizeof(void *) : size;
+		block_size = (block_size + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+		blocks_per_chunk = chunk_blocks;
+		free_list = nullptr;
+	}
+	~block_pool_t()
+	{
+		for (auto chunk_iter = chunks.begin(); chunk_iter != chunks.end(); ++chunk_iter)
+		{
+			::operator delete(*chunk_iter);
+		}
+	}
+
+	block_pool_t(const block_pool_t &) = delete;
+	block_pool_t &operator=(const block_pool_t &) = delete;
+
+	// Get a block from the pool.
+	void *allocate()
+	{
+		if (free_list == nullptr) grow();
+
+		void *block = free_list;
+		free_list = *static_cast<void **>(block);
+
+		if (++stats.live > stats.high_water) stats.high_water = stats.live;
+		return block;
+	}
+
+	// Return a block to the pool.
+	void release(void *block)
+	{
+		*static_cast<void **>(block) = free_list;
+		free_list = block;
+		--stats.live;
+	}
+
+	size_t get_block_size() const
+	{
+		return block_size;
+	}
+
+	const pool_stats_t &get_stats() const
+	{
+		return stats;
+	}
+};
+
+// A pool that constructs and destroys objects of a single type.
+template <typename T>
+class object_pool_t
+{
+private:
+	block_pool_t blocks;
+
+public:
+	object_pool_t(size_t chunk_objects = 4096) : blocks((sizeof(T) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t), chunk_objects) {}
+
+	// Construct a new object within the pool.
+	template <typename... Args>
+	T *create(Args &&...args)
+	{
+		return new (blocks.allocate()) T(std::forward<Args>(args)...);
+	}
+
+	// Destroy an object that was created by this pool.
+	void destroy(T *object)
+	{
+		object->~T();
+		blocks.release(object);
+	}
+
+	const pool_stats_t &get_stats() const
+	{
+		return blocks.get_stats();
+	}
+};
+
+// Get a list of all shared block pools that have been created so far (for reporting statistics).
+inline std::vector<block_pool_t *> &shared_block_pools()
+{
+	static std::vector<block_pool_t *> *pools = new std::vector<block_pool_t *>();
+	return *pools;
+}
+
+// Get the shared block pool for blocks of a certain size (used by pool_allocator_t).
+// Shared pools are intentionally never destroyed, since containers that use them may outlive any static object.
+template <size_t SIZE>
+block_pool_t &shared_block_pool()
+{
+	static block_pool_t *pool = nullptr;
+	if (pool == nullptr)
+	{
+		pool = new block_pool_t(SIZE);
+		shared_block_pools().push_back(pool);
+	}
+	return *pool;
+}
+
+// An STL-compatible allocator that serves single-object allocations (e.g. the nodes of node-based containers) from
+// a shared block pool, and falls back to the standard allocator for arrays (e.g. hash table bucket arrays).
+template <typename T>
+struct pool_allocator_t
+{
+	typedef T value_type;
+
+	pool_allocator_t() noexcept {}
+	template <typename U>
+	pool_allocator_t(const pool_allocator_t<U> &) noexcept {}
+
+	T *allocate(size_t n)
+	{
+		if (n == 1 && alignof(T) <= alignof(void *)) return static_cast<T *>(shared_block_pool<sizeof(T)>().allocate());
+		return std::allocator<T>().allocate(n);
+	}
+
+	void deallocate(T *ptr, size_t n)
+	{
+		if (n == 1 && alignof(T) <= alignof(void *)) shared_block_pool<sizeof(T)>().release(ptr);
+		else std::allocator<T>().deallocate(ptr, n);
+	}
+
+	template <typename U>
+	bool operator==(const pool_allocator_t<U> &) const noexcept
+	{
+		return true;
+	}
+	template <typename U>
+	bool operator!=(const pool_allocator_t<U> &) const noexcept
+	{
+		return false;
+	}
+};
\ No newline at end of file
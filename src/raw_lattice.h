@@ -0,0 +1,149 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+
+#include "lattice.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "spin_field.h"
+#include "types.h"
+
+/*
+
+A raw binary lattice format (.gsr) that can be memory-mapped and used without any parsing.
+
+	char[8]		magic ("GRAINSR1")
+	uint32		side length
+	uint32		bytes per grain ID (always 4)
+	uint32		byte order mark (0x01020304, written in the byte order of the host that wrote the file)
+	uint32		reserved (0)
+	uint64		voxel count
+	char[32]	padding (zero), so that the grain IDs start at a 64-byte offset
+	uint32[]	the grain IDs in lattice order (x fastest, then y, then z)
+
+*/
+class raw_lattice
+{
+public:
+	static const size_t HEADER_SIZE = 64;
+	static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+	static const char *magic()
+	{
+		return "GRAINSR1";
+	}
+
+	// A raw lattice file that has been mapped into memory. The grain IDs can be used in place unless they need swapping.
+	class mapping_t
+	{
+	private:
+		mapped_file_t file;
+
+	public:
+		coord_t side_length = 0;
+		size_t voxel_count = 0;
+		// True if the file was written on a host with the opposite byte order.
+		bool swapped = false;
+		const uint32_t *spins = nullptr;
+
+		mapping_t(const char *fname) : file(fname)
+		{
+			const char *data = file.begin();
+			if (file.size() < HEADER_SIZE || memcmp(data, magic(), 8) != 0)
+			{
+				std::cout << "Error: " << fname << " is not a raw grainsim lattice." << std::endl;
+				exit(0);
+			}
+
+			uint32_t side, spin_bytes, mark;
+			uint64_t count;
+			memcpy(&side, data + 8, 4);
+			memcpy(&spin_bytes, data + 12, 4);
+			memcpy(&mark, data + 16, 4);
+			memcpy(&count, data + 24, 8);
+			swapped = mark != BYTE_ORDER_MARK;
+			if (swapped)
+			{
+				side = swap_bytes(side);
+				spin_bytes = swap_bytes(spin_bytes);
+				count = (uint64_t)swap_bytes(count & 0xffffffff) << 32 | swap_bytes(count >> 32);
+			}
+			side_length = side;
+			voxel_count = count;
+
+			if ((swapped && swap_bytes(mark) != BYTE_ORDER_MARK) || spin_bytes != sizeof(uint32_t)
+				|| voxel_count != (size_t)side_length * side_length * side_length || file.size() < HEADER_SIZE + voxel_count * sizeof(uint32_t))
+			{
+				std::cout << "Error: Corrupt raw lattice header in " << fname << "." << std::endl;
+				exit(0);
+			}
+
+			spins = reinterpret_cast<const uint32_t *>(data + HEADER_SIZE);
+		}
+	};
+
+	// Reverse the byte order of a 32-bit value.
+	static uint32_t swap_bytes(uint32_t value)
+	{
+		return (value >> 24) | ((value >> 8) & 0x0000ff00) | ((value << 8) & 0x00ff0000) | (value << 24);
+	}
+
+	// Save a spin field to a raw lattice file.
+	static void to_raw(const char *fname, const spin_field_t &field)
+	{
+		std::ofstream file(fname, std::ios::binary);
+
+		std::cout << "Writing to " << fname << std::endl;
+
+		unsigned char header[HEADER_SIZE] = {};
+		uint32_t side = field.side_length, spin_bytes = sizeof(uint32_t), mark = BYTE_ORDER_MARK;
+		uint64_t voxel_count = field.voxel_count();
+		memcpy(header, magic(), 8);
+		memcpy(header + 8, &side, 4);
+		memcpy(header + 12, &spin_bytes, 4);
+		memcpy(header + 16, &mark, 4);
+		memcpy(header + 24, &voxel_count, 8);
+		file.write(reinterpret_cast<const char *>(header), HEADER_SIZE);
+		file.write(reinterpret_cast<const char *>(field.spins.data()), voxel_count * sizeof(uint32_t));
+
+		file.close();
+	}
+
+	// Create a lattice object from a raw lattice file (the grain IDs are copied straight out of the mapping, in parallel).
+	static lattice_t *from_raw(const char *fname, bool init=true)
+	{
+		std::cout << "Loading raw lattice " << fname << std::endl;
+
+		mapping_t mapping(fname);
+		lattice_t *new_cube = new lattice_t(mapping.side_length);
+
+		// Copy in chunks of whole pages, so that each thread reads its own part of the file.
+		const size_t CHUNK_SIZE = 1 << 16;
+		const uint32_t *spins = mapping.spins;
+		bool swapped = mapping.swapped;
+		size_t voxel_count = mapping.voxel_count;
+		voxel_t *voxels = new_cube->voxels;
+		parallel_for((voxel_count + CHUNK_SIZE - 1) / CHUNK_SIZE, [=](size_t chunk)
+		{
+			size_t end = std::min(voxel_count, (chunk + 1) * CHUNK_SIZE);
+			for (size_t i = chunk * CHUNK_SIZE; i < end; ++i)
+			{
+				voxels[i].spin = swapped ? swap_bytes(spins[i]) : spins[i];
+			}
+		});
+
+		std::cout << "Done loading!" << std::endl;
+		if (init)
+		{
+			new_cube->init();
+		}
+
+		return new_cube;
+	}
+};
\ No newline at end of file
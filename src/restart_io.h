@@ -0,0 +1,202 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <type_traits>
+
+#ifdef __linux__
+#include <unistd.h>
+#else
+#include <filesystem>
+#endif
+
+// The magic string and version at the start of every restart file.
+inline const char *restart_magic()
+{
+	return "GRAINRS1";
+}
+static const uint32_t RESTART_VERSION = 7;
+
+// Binary streams for restart files. Restart files hold the complete simulation state in the native byte order and layout, so they are
+// only meant to be read back by the same build on the same kind of machine.
+//
+// Unordered containers are stored with their bucket count and their elements in iteration order. When they are read back, the bucket
+// count is restored first and the elements are inserted in reverse, which reproduces the original iteration order (elements within a
+// bucket, and buckets themselves, are linked in front of the older ones). Resumed runs therefore visit boundaries, junctions and
+// voxels in exactly the same order as the original run would have.
+class restart_writer_t
+{
+private:
+	std::ofstream file;
+	std::string path, temp_path;
+
+public:
+	// Open a restart file for writing (the data goes to a temporary file until close(), so that an interrupted write never replaces a good restart file).
+	restart_writer_t(const std::string &path) : path(path), temp_path(path + ".tmp")
+	{
+		file.open(temp_path.c_str(), std::ios::binary);
+		if (!file)
+		{
+			std::cout << "Error: Could not write restart file " << temp_path << "." << std::endl;
+			exit(0);
+		}
+		file.write(restart_magic(), 8);
+		put(RESTART_VERSION);
+	}
+
+	template <typename T>
+	void put(const T &value)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values can be written directly.");
+		file.write(reinterpret_cast<const char *>(&value), sizeof(T));
+	}
+	template <typename T>
+	void put_array(const T *values, size_t count)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values can be written directly.");
+		file.write(reinterpret_cast<const char *>(values), count * sizeof(T));
+	}
+	template <typename T>
+	void put_vector(const std::vector<T> &values)
+	{
+		put<uint64_t>(values.size());
+		put_array(values.data(), values.size());
+	}
+	void put_string(const std::string &value)
+	{
+		put<uint64_t>(value.size());
+		file.write(value.data(), value.size());
+	}
+
+	// Write an unordered container (put_element writes a single element).
+	template <typename C, typename FUNC>
+	void put_unordered(const C &container, FUNC put_element)
+	{
+		put<uint64_t>(container.bucket_count());
+		put<uint64_t>(container.size());
+		for (auto iter = container.begin(); iter != container.end(); ++iter)
+		{
+			put_element(*iter);
+		}
+	}
+
+	// Finish the file and move it into place.
+	void close()
+	{
+		file.close();
+		if (!file || std::rename(temp_path.c_str(), path.c_str()) != 0)
+		{
+			std::cout << "Error: Could not write restart file " << path << "." << std::endl;
+			exit(0);
+		}
+	}
+};
+
+class restart_reader_t
+{
+private:
+	std::ifstream file;
+	std::string path;
+
+	void check()
+	{
+		if (!file)
+		{
+			std::cout << "Error: Unexpected end of restart file " << path << "." << std::endl;
+			exit(0);
+		}
+	}
+
+public:
+	restart_reader_t(const std::string &path) : path(path)
+	{
+		file.open(path.c_str(), std::ios::binary);
+		if (!file)
+		{
+			std::cout << "Error: Could not open restart file " << path << "." << std::endl;
+			exit(0);
+		}
+
+		char magic[8];
+		if (!file.read(magic, 8) || std::string(magic, 8) != restart_magic() || get<uint32_t>() != RESTART_VERSION)
+		{
+			std::cout << "Error: " << path << " is not a compatible restart file." << std::endl;
+			exit(0);
+		}
+	}
+
+	template <typename T>
+	T get()
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values can be read directly.");
+		T value;
+		file.read(reinterpret_cast<char *>(&value), sizeof(T));
+		check();
+		return value;
+	}
+	template <typename T>
+	void get_array(T *values, size_t count)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values can be read directly.");
+		file.read(reinterpret_cast<char *>(values), count * sizeof(T));
+		check();
+	}
+	template <typename T>
+	void get_vector(std::vector<T> *values)
+	{
+		values->resize(get<uint64_t>());
+		get_array(values->data(), values->size());
+	}
+	std::string get_string()
+	{
+		std::string value(get<uint64_t>(), '\0');
+		file.read(&value[0], value.size());
+		check();
+		return value;
+	}
+
+	// Read an unordered container (get_element reads and returns a single element), restoring its iteration order.
+	template <typename C, typename FUNC>
+	void get_unordered(C *container, FUNC get_element)
+	{
+		size_t bucket_count = get<uint64_t>(), size = get<uint64_t>();
+		std::vector<typename C::value_type> elements;
+		elements.reserve(size);
+		for (size_t i = 0; i < size; ++i)
+		{
+			elements.push_back(get_element());
+		}
+
+		container->clear();
+		if (bucket_count > container->bucket_count()) container->rehash(bucket_count);
+		for (auto iter = elements.rbegin(); iter != elements.rend(); ++iter)
+		{
+			container->insert(*iter);
+		}
+	}
+};
+
+// Open an output file that a resumed run continues. When resume_offset is not negative, the file is cut back to that size (the size it had
+// when the restart file was written) and opened for appending, so that nothing written after the restart file is duplicated.
+// Otherwise, or if the file cannot be cut back, it is started over. Returns whether the file was resumed.
+inline bool open_resumable_file(std::ofstream *file, const std::string &path, long resume_offset, std::ios::openmode mode = std::ios::out)
+{
+	bool resumed = false;
+	if (resume_offset >= 0)
+	{
+#ifdef __linux__
+		resumed = truncate(path.c_str(), resume_offset) == 0;
+#else
+		std::error_code error;
+		std::filesystem::resize_file(path, resume_offset, error);
+		resumed = !error;
+#endif
+	}
+
+	*file = std::ofstream(path.c_str(), resumed ? mode | std::ios::app : mode);
+	return resumed;
+}
\ No newline at end of file
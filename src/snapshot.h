@@ -0,0 +1,411 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+
+#include "lattice.h"
+#include "parallel.h"
+#include "restart_io.h"
+#include "spin_field.h"
+#include "types.h"
+
+/*
+
+A native, compressed snapshot format for the spin field (.gss). All values are little-endian.
+
+	char[8]		magic ("GRAINSS1")
+	uint32		side length
+	uint32		brick size
+	uint32		frame type (0 = keyframe, 1 = delta)
+	uint32		keyframe name length, followed by the name (relative to the folder of the delta frame; zero for keyframes)
+	uint64		brick count, followed by the end offset of each brick (relative to the start of the brick data)
+	...			brick data
+
+The lattice is split into bricks of (brick size)^3 voxels (clipped at the lattice edges), ordered x fastest, then y, then z.
+Each brick holds the original grain IDs of its voxels (x fastest) in one of three encodings, chosen per brick:
+	BRICK_ZERO		every value is zero (no data)
+	BRICK_RLE		pairs of varints (value, run length)
+	BRICK_VARINT	one varint per value
+Delta frames store each grain ID XORed with the keyframe's, so that unchanged voxels are zero and unchanged bricks are empty.
+
+*/
+class snapshot
+{
+public:
+	static const char *magic()
+	{
+		return "GRAINSS1";
+	}
+	enum frame_type_t : uint32_t { FRAME_KEY = 0, FRAME_DELTA = 1 };
+	enum brick_encoding_t : unsigned char { BRICK_ZERO = 0, BRICK_RLE = 1, BRICK_VARINT = 2 };
+
+	static void put_u32(std::vector<unsigned char> *out, uint32_t value)
+	{
+		for (char i = 0; i < 4; ++i) out->push_back((value >> (i * 8)) & 0xff);
+	}
+	static void put_u64(std::vector<unsigned char> *out, uint64_t value)
+	{
+		for (char i = 0; i < 8; ++i) out->push_back((value >> (i * 8)) & 0xff);
+	}
+	static void put_varint(std::vector<unsigned char> *out, uint32_t value)
+	{
+		while (value >= 0x80)
+		{
+			out->push_back((value & 0x7f) | 0x80);
+			value >>= 7;
+		}
+		out->push_back(value);
+	}
+	static size_t varint_size(uint32_t value)
+	{
+		size_t size = 1;
+		while (value >= 0x80)
+		{
+			value >>= 7;
+			++size;
+		}
+		return size;
+	}
+
+	static uint32_t get_u32(const unsigned char *data)
+	{
+		return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+	}
+	static uint64_t get_u64(const unsigned char *data)
+	{
+		return (uint64_t)get_u32(data) | ((uint64_t)get_u32(data + 4) << 32);
+	}
+	static uint32_t get_varint(const unsigned char **data, const unsigned char *end)
+	{
+		uint32_t value = 0;
+		for (char shift = 0; *data < end && shift < 35; shift += 7)
+		{
+			unsigned char byte = *(*data)++;
+			value |= (uint32_t)(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) return value;
+		}
+		std::cout << "Error: Corrupt snapshot brick." << std::endl;
+		exit(0);
+	}
+
+	// Get the number of bricks along each axis.
+	static size_t bricks_per_side(coord_t side_length, coord_t brick_size)
+	{
+		return (side_length + brick_size - 1) / brick_size;
+	}
+
+	// Call a function with the lattice index of every voxel within a brick (in brick order).
+	template <typename FUNC>
+	static void for_each_in_brick(coord_t side_length, coord_t brick_size, size_t brick, FUNC func)
+	{
+		size_t per_side = bricks_per_side(side_length, brick_size);
+		coord_t
+			x0 = (brick % per_side) * brick_size,
+			y0 = (brick / per_side % per_side) * brick_size,
+			z0 = (brick / per_side / per_side) * brick_size,
+			x1 = std::min(x0 + brick_size, side_length),
+			y1 = std::min(y0 + brick_size, side_length),
+			z1 = std::min(z0 + brick_size, side_length);
+
+		for (coord_t z = z0; z < z1; ++z)
+			for (coord_t y = y0; y < y1; ++y)
+			{
+				size_t row = (size_t)y * side_length + (size_t)z * side_length * side_length;
+				for (coord_t x = x0; x < x1; ++x) func(row + x);
+			}
+	}
+
+	// Encode the values of a single brick, picking the smallest encoding.
+	static void encode_brick(const std::vector<uint32_t> &values, std::vector<unsigned char> *out)
+	{
+		out->clear();
+
+		size_t rle_size = 0, varint_total = 0;
+		bool all_zero = true;
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			all_zero &= values[i] == 0;
+			varint_total += varint_size(values[i]);
+			if (i == 0 || values[i] != values[i - 1])
+			{
+				size_t run = 1;
+				while (i + run < values.size() && values[i + run] == values[i]) ++run;
+				rle_size += varint_size(values[i]) + varint_size(run);
+			}
+		}
+
+		if (all_zero)
+		{
+			out->push_back(BRICK_ZERO);
+		}
+		else if (rle_size <= varint_total)
+		{
+			out->push_back(BRICK_RLE);
+			for (size_t i = 0; i < values.size();)
+			{
+				size_t run = 1;
+				while (i + run < values.size() && values[i + run] == values[i]) ++run;
+				put_varint(out, values[i]);
+				put_varint(out, run);
+				i += run;
+			}
+		}
+		else
+		{
+			out->push_back(BRICK_VARINT);
+			for (size_t i = 0; i < values.size(); ++i) put_varint(out, values[i]);
+		}
+	}
+
+	// Decode a single brick into the given array (values are XORed into it, so that delta frames can be applied onto a keyframe).
+	static void decode_brick(const unsigned char *data, const unsigned char *end, coord_t side_length, coord_t brick_size, size_t brick, uint32_t *spins)
+	{
+		if (data >= end)
+		{
+			std::cout << "Error: Corrupt snapshot brick." << std::endl;
+			exit(0);
+		}
+
+		unsigned char encoding = *data++;
+		if (encoding == BRICK_ZERO) return;
+
+		uint32_t value = 0;
+		size_t run = 0;
+		for_each_in_brick(side_length, brick_size, brick, [&](size_t index)
+		{
+			if (encoding == BRICK_RLE)
+			{
+				if (run == 0)
+				{
+					value = get_varint(&data, end);
+					run = get_varint(&data, end);
+				}
+				--run;
+			}
+			else
+			{
+				value = get_varint(&data, end);
+			}
+			spins[index] ^= value;
+		});
+	}
+
+	// Get the folder part of a path (including the trailing separator).
+	static std::string folder_of(const std::string &path)
+	{
+		size_t slash = path.find_last_of("/\\");
+		return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+	}
+
+	// Read the grain IDs stored in a snapshot (resolving delta frames against their keyframe).
+	static void read_spins(const char *fname, coord_t *out_side_length, std::vector<uint32_t> *spins)
+	{
+		std::ifstream file(fname, std::ios::binary);
+		if (!file)
+		{
+			std::cout << "Error: Could not open snapshot " << fname << "." << std::endl;
+			exit(0);
+		}
+		std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		file.close();
+
+		const unsigned char *pos = data.data(), *end = data.data() + data.size();
+		if (data.size() < 28 || memcmp(pos, magic(), 8) != 0)
+		{
+			std::cout << "Error: " << fname << " is not a grainsim snapshot." << std::endl;
+			exit(0);
+		}
+		coord_t side_length = get_u32(pos + 8), brick_size = get_u32(pos + 12);
+		uint32_t frame_type = get_u32(pos + 16), name_length = get_u32(pos + 20);
+		pos += 24;
+
+		if (frame_type == FRAME_DELTA)
+		{
+			std::string key_name(reinterpret_cast<const char *>(pos), name_length);
+			coord_t key_side_length;
+			read_spins((folder_of(fname) + key_name).c_str(), &key_side_length, spins);
+			if (key_side_length != side_length)
+			{
+				std::cout << "Error: Snapshot " << fname << " does not match its keyframe." << std::endl;
+				exit(0);
+			}
+		}
+		else
+		{
+			spins->assign((size_t)side_length * side_length * side_length, 0);
+		}
+		pos += name_length;
+
+		size_t brick_count = get_u64(pos);
+		pos += 8;
+		const unsigned char *offsets = pos, *brick_data = pos + brick_count * 8;
+		if (brick_count != bricks_per_side(side_length, brick_size) * bricks_per_side(side_length, brick_size) * bricks_per_side(side_length, brick_size) || brick_data > end)
+		{
+			std::cout << "Error: Corrupt snapshot header in " << fname << "." << std::endl;
+			exit(0);
+		}
+
+		// Bricks cover disjoint voxels, so they can be decoded in parallel.
+		uint32_t *spin_data = spins->data();
+		parallel_for(brick_count, [=](size_t brick)
+		{
+			uint64_t begin = brick == 0 ? 0 : get_u64(offsets + (brick - 1) * 8), brick_end = get_u64(offsets + brick * 8);
+			decode_brick(brick_data + begin, std::min(end, brick_data + brick_end), side_length, brick_size, brick, spin_data);
+		});
+
+		*out_side_length = side_length;
+	}
+
+	// Create a lattice object from a snapshot.
+	static lattice_t *from_snapshot(const char *fname, bool init=true)
+	{
+		std::cout << "Loading snapshot " << fname << std::endl;
+
+		coord_t side_length;
+		std::vector<uint32_t> spins;
+		read_spins(fname, &side_length, &spins);
+
+		lattice_t *new_cube = new lattice_t(side_length);
+		for (size_t i = 0; i < spins.size(); ++i)
+		{
+			new_cube->voxels[i].spin = spins[i];
+		}
+
+		std::cout << "Done loading!" << std::endl;
+		if (init)
+		{
+			new_cube->init();
+		}
+
+		return new_cube;
+	}
+};
+
+// Writes a series of snapshots, storing every keyframe_interval'th frame in full and the rest as deltas against the last keyframe.
+// Frames are prepared in order (which decides their type and computes their deltas) and can then be encoded and written at any time,
+// e.g. by a background writer.
+class snapshot_writer_t
+{
+private:
+	size_t keyframe_interval;
+	coord_t brick_size;
+	// The number of frames prepared since (and including) the last keyframe.
+	size_t frames_since_key = 0;
+
+	// The grain IDs and file name of the last keyframe.
+	std::vector<uint32_t> key_spins;
+	std::string key_name;
+
+public:
+	// A prepared frame, holding everything needed to write it.
+	class frame_t
+	{
+	private:
+		friend class snapshot_writer_t;
+
+		std::string fname, key_name;
+		coord_t side_length, brick_size;
+		bool keyframe;
+		// The grain IDs of the frame (XORed with the keyframe's for delta frames).
+		std::vector<uint32_t> values;
+
+	public:
+		// Encode the frame and write it to its file.
+		void write() const
+		{
+			// Encode all bricks in parallel (each thread keeps its own scratch space for the brick's values).
+			size_t per_side = snapshot::bricks_per_side(side_length, brick_size);
+			size_t brick_count = per_side * per_side * per_side;
+			std::vector<std::vector<unsigned char> > encoded_bricks(brick_count);
+			const uint32_t *frame_values = values.data();
+			parallel_for(brick_count, [&](size_t brick)
+			{
+				thread_local std::vector<uint32_t> brick_values;
+				brick_values.clear();
+				snapshot::for_each_in_brick(side_length, brick_size, brick, [&](size_t index) { brick_values.push_back(frame_values[index]); });
+				snapshot::encode_brick(brick_values, &encoded_bricks[brick]);
+			});
+
+			std::vector<unsigned char> header(snapshot::magic(), snapshot::magic() + 8);
+			snapshot::put_u32(&header, side_length);
+			snapshot::put_u32(&header, brick_size);
+			snapshot::put_u32(&header, keyframe ? snapshot::FRAME_KEY : snapshot::FRAME_DELTA);
+			snapshot::put_u32(&header, keyframe ? 0 : key_name.length());
+			if (!keyframe) header.insert(header.end(), key_name.begin(), key_name.end());
+			snapshot::put_u64(&header, brick_count);
+			uint64_t offset = 0;
+			for (size_t brick = 0; brick < brick_count; ++brick)
+			{
+				offset += encoded_bricks[brick].size();
+				snapshot::put_u64(&header, offset);
+			}
+
+			std::ofstream file(fname.c_str(), std::ios::binary);
+			file.write(reinterpret_cast<const char *>(header.data()), header.size());
+			for (size_t brick = 0; brick < brick_count; ++brick)
+			{
+				file.write(reinterpret_cast<const char *>(encoded_bricks[brick].data()), encoded_bricks[brick].size());
+			}
+			file.close();
+
+			std::cout << "Wrote " << (keyframe ? "keyframe" : "delta frame") << " " << fname << " (" << (header.size() + offset) << " bytes)." << std::endl;
+		}
+	};
+
+	snapshot_writer_t(size_t keyframe_interval = 1, coord_t brick_size = 32) : keyframe_interval(keyframe_interval > 0 ? keyframe_interval : 1), brick_size(brick_size) {}
+
+	// Save the last keyframe, so that a resumed run keeps writing deltas against it.
+	void save_state(restart_writer_t *out)
+	{
+		out->put<uint64_t>(frames_since_key);
+		out->put_vector(key_spins);
+		out->put_string(key_name);
+	}
+	void load_state(restart_reader_t *in)
+	{
+		frames_since_key = in->get<uint64_t>();
+		in->get_vector(&key_spins);
+		key_name = in->get_string();
+	}
+
+	// Prepare the next frame of the series from a spin field.
+	frame_t prepare(const char *fname, spin_field_t field)
+	{
+		std::cout << "Writing to " << fname << std::endl;
+
+		size_t voxel_count = field.voxel_count();
+		bool keyframe = frames_since_key == 0 || frames_since_key >= keyframe_interval || key_spins.size() != voxel_count;
+		frames_since_key = keyframe ? 1 : frames_since_key + 1;
+
+		frame_t frame;
+		frame.fname = fname;
+		frame.key_name = key_name;
+		frame.side_length = field.side_length;
+		frame.brick_size = brick_size;
+		frame.keyframe = keyframe;
+
+		if (keyframe)
+		{
+			key_spins = field.spins;
+			key_name = frame.fname.substr(snapshot::folder_of(frame.fname).length());
+		}
+		else
+		{
+			for (size_t i = 0; i < voxel_count; ++i) field.spins[i] ^= key_spins[i];
+		}
+		frame.values.swap(field.spins);
+
+		return frame;
+	}
+
+	// Write the next frame of the series to a snapshot file.
+	void write(const char *fname, spin_field_t field)
+	{
+		prepare(fname, std::move(field)).write();
+	}
+};
\ No newline at end of file
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "lattice.h"
+#include "parallel.h"
+#include "types.h"
+
+// The (original) grain IDs of every voxel in lattice order, copied out of a lattice so that they can be written to disk while the
+// simulation carries on. At 4 bytes per voxel, a copy is small next to the lattice itself.
+struct spin_field_t
+{
+	coord_t side_length = 0;
+	std::vector<uint32_t> spins;
+
+	spin_field_t() {}
+
+	// Copy the grain IDs out of a lattice (in parallel).
+	explicit spin_field_t(lattice_t *lattice) : side_length(lattice->side_length), spins((size_t)lattice->side_length * lattice->side_length * lattice->side_length)
+	{
+		const size_t CHUNK_SIZE = 1 << 16;
+		size_t voxel_count = spins.size();
+		uint32_t *output = spins.data();
+		parallel_for((voxel_count + CHUNK_SIZE - 1) / CHUNK_SIZE, [=](size_t chunk)
+		{
+			size_t end = std::min(voxel_count, (chunk + 1) * CHUNK_SIZE);
+			for (size_t i = chunk * CHUNK_SIZE; i < end; ++i)
+			{
+				output[i] = lattice->original_spin(lattice->voxels[i].spin);
+			}
+		});
+	}
+
+	size_t voxel_count() const
+	{
+		return spins.size();
+	}
+};
\ No newline at end of file
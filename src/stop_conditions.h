@@ -0,0 +1,88 @@
+#pragma once
+
+#include <string>
+#include <cmath>
+
+#include "types.h"
+#include "lattice.h"
+#include "restart_io.h"
+
+// Conditions that end a simulation early. Each one is evaluated from state that the lattice tracks incrementally, so checking
+// them costs O(1) per step. A value of zero disables a condition.
+struct stop_conditions_t
+{
+	// Stop once this many grains (or fewer) remain.
+	spin_t grain_count = 0;
+	// Stop once the mean grain volume reaches this many voxels.
+	double mean_grain_volume = 0;
+	// Stop once the system activity drops to this value (or below).
+	activ_t activity = 0;
+	// Stop once the fraction of transformed boundaries has changed by less than stall_tolerance over the last stall_window timesteps.
+	// The window only starts once the first boundary has been transformed, and should span at least one transition interval.
+	double stall_window = 0, stall_tolerance = 0;
+
+private:
+	// The start of the current stall window and the transformed fraction at that point (negative until the window starts).
+	double stall_start = 0, stall_fraction = -1;
+
+	static double transformed_fraction(lattice_t *cube)
+	{
+		boundary_tracker_t *tracker = &cube->boundary_tracker;
+		return tracker->total_boundary_count > 0 ? (double)tracker->transformed_boundary_count / tracker->total_boundary_count : 0;
+	}
+
+public:
+	void save_state(restart_writer_t *out)
+	{
+		out->put(stall_start);
+		out->put(stall_fraction);
+	}
+	void load_state(restart_reader_t *in)
+	{
+		stall_start = in->get<double>();
+		stall_fraction = in->get<double>();
+	}
+
+	// Check if any condition is set at all.
+	bool enabled()
+	{
+		return grain_count > 0 || mean_grain_volume > 0 || activity > 0 || stall_window > 0;
+	}
+
+	// Check all conditions (returns a description of the first condition that has been met, or an empty string).
+	std::string check(double timestep, lattice_t *cube)
+	{
+		if (grain_count > 0 && cube->live_grain_count() <= grain_count)
+		{
+			return "grain count reached " + std::to_string(cube->live_grain_count());
+		}
+		if (mean_grain_volume > 0 && cube->mean_grain_volume() >= mean_grain_volume)
+		{
+			return "mean grain volume reached " + std::to_string(cube->mean_grain_volume());
+		}
+		if (activity > 0 && cube->system_activity() <= activity)
+		{
+			return "system activity dropped to " + std::to_string(cube->system_activity());
+		}
+		if (stall_window > 0 && cube->boundary_tracker.transformed_boundary_count > 0)
+		{
+			if (stall_fraction < 0)
+			{
+				stall_start = timestep;
+				stall_fraction = transformed_fraction(cube);
+			}
+			else if (timestep - stall_start >= stall_window)
+			{
+				double fraction = transformed_fraction(cube);
+				if (std::fabs(fraction - stall_fraction) < stall_tolerance)
+				{
+					return "transformed boundary fraction stalled at " + std::to_string(fraction);
+				}
+
+				stall_start = timestep;
+				stall_fraction = fraction;
+			}
+		}
+		return std::string();
+	}
+};
\ No newline at end of file
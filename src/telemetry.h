@@ -0,0 +1,58 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+
+#include "lattice.h"
+#include "restart_io.h"
+
+// Writes a time series of lattice-wide statistics to a CSV file. Every value is maintained incrementally by the lattice,
+// so a sample costs O(1).
+class telemetry_log_t
+{
+private:
+	std::ofstream file;
+
+public:
+	// Open the log file and write the header.
+	// When resuming from a restart file, the log is cut back to the size it had when the restart file was written and appended to.
+	void open(const std::string &path, long resume_offset = -1)
+	{
+		std::cout << "Writing telemetry to " << path << std::endl;
+
+		if (!open_resumable_file(&file, path, resume_offset))
+		{
+			file << "timestep,flips,energy,grains,mean_grain_volume,boundaries,activity\n";
+		}
+
+		// Long runs reach timesteps where the default 6 significant digits would no longer tell samples apart.
+		file << std::setprecision(17);
+	}
+
+	// Get the current size of the log file (flushing it first).
+	long offset()
+	{
+		flush();
+		return file.tellp();
+	}
+
+	// Write a single sample.
+	void sample(double timestep, lattice_t *cube)
+	{
+		file << timestep << ',' << cube->total_flips << ',' << cube->boundary_energy << ',' << cube->live_grain_count() << ','
+			 << cube->mean_grain_volume() << ',' << cube->boundary_count() << ',' << cube->system_activity() << '\n';
+	}
+
+	// Write buffered samples to disk.
+	void flush()
+	{
+		std::flush(file);
+	}
+
+	void close()
+	{
+		file.close();
+	}
+};
\ No newline at end of file
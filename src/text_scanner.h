@@ -0,0 +1,144 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <thread>
+
+#include "voxel.h"
+#include "parallel.h"
+
+// A parallel scanner for the grain IDs in text lattice files (.vtk and .ph), which works on a mapped file.
+// The data section is split at line boundaries into one chunk per thread. Each chunk is scanned twice: once to count its grain IDs
+// (which gives every chunk its offset into the lattice) and once to store them. Grain IDs are whitespace-separated unsigned
+// integers, and the data section ends at the first line that does not start with a digit (or at the end of the file).
+class text_scanner
+{
+private:
+	// Don't split files into chunks smaller than this.
+	static const size_t MIN_CHUNK_SIZE = 1 << 16;
+
+	// The result of scanning a chunk.
+	struct chunk_t
+	{
+		const char *begin, *end;
+		size_t count = 0;
+		// True if the data section ends within this chunk (in which case end has been moved there).
+		bool terminated = false;
+		// The first character that is not part of a grain ID (nullptr if there is none).
+		const char *bad = nullptr;
+	};
+
+	// Scan a chunk, storing the grain IDs if voxels is given (voxels must point at the chunk's first voxel).
+	static void scan_chunk(chunk_t *chunk, voxel_t *voxels)
+	{
+		const char *pos = chunk->begin, *end = chunk->end;
+		size_t count = 0;
+		bool line_start = true;
+
+		while (pos < end)
+		{
+			char c = *pos;
+			if (c >= '0' && c <= '9')
+			{
+				uint64_t value = 0;
+				while (pos < end && *pos >= '0' && *pos <= '9' && value <= UINT32_MAX)
+				{
+					value = value * 10 + (*pos - '0');
+					++pos;
+				}
+				if (value > UINT32_MAX)
+				{
+					chunk->bad = pos;
+					break;
+				}
+
+				if (voxels != nullptr) voxels[count].spin = value;
+				++count;
+				line_start = false;
+			}
+			else if (c == '\n')
+			{
+				line_start = true;
+				++pos;
+			}
+			else if (c == ' ' || c == '\t' || c == '\r')
+			{
+				++pos;
+			}
+			else if (line_start)
+			{
+				chunk->terminated = true;
+				chunk->end = pos;
+				break;
+			}
+			else
+			{
+				chunk->bad = pos;
+				break;
+			}
+		}
+
+		chunk->count = count;
+	}
+
+public:
+	// Read the line starting at pos (without the line break) and move pos to the start of the next line.
+	static std::string next_line(const char **pos, const char *end)
+	{
+		const char *line_end = std::find(*pos, end, '\n');
+		std::string line(*pos, line_end);
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		*pos = line_end == end ? end : line_end + 1;
+		return line;
+	}
+
+	// Parse the grain IDs in [begin, end) into the voxels, checking that there are exactly voxel_count of them.
+	static void parse_spins(const char *fname, const char *begin, const char *end, voxel_t *voxels, size_t voxel_count)
+	{
+		size_t size = end - begin;
+		size_t chunk_count = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), size / MIN_CHUNK_SIZE));
+
+		// Split the data at line breaks, so that no grain ID (or line) straddles two chunks.
+		std::vector<chunk_t> chunks(chunk_count);
+		const char *chunk_begin = begin;
+		for (size_t c = 0; c < chunk_count; ++c)
+		{
+			const char *chunk_end = c + 1 == chunk_count ? end : std::find(std::max(chunk_begin, begin + size * (c + 1) / chunk_count), end, '\n');
+			if (chunk_end != end) ++chunk_end;
+			chunks[c].begin = chunk_begin;
+			chunks[c].end = chunk_end;
+			chunk_begin = chunk_end;
+		}
+
+		// First pass: count the grain IDs in each chunk.
+		parallel_for(chunk_count, [&](size_t c) { scan_chunk(&chunks[c], nullptr); });
+
+		size_t total = 0, used_chunks = 0;
+		while (used_chunks < chunk_count)
+		{
+			chunk_t *chunk = &chunks[used_chunks++];
+			if (chunk->bad != nullptr)
+			{
+				size_t line = std::count(begin, chunk->bad, '\n') + 1;
+				std::cout << "Error: Unexpected character '" << *chunk->bad << "' in the grain IDs of " << fname << " (data line " << line << ")." << std::endl;
+				exit(0);
+			}
+			total += chunk->count;
+			if (chunk->terminated) break;
+		}
+
+		if (total != voxel_count)
+		{
+			std::cout << "Error: " << fname << " contains " << total << " grain IDs, but its dimensions require " << voxel_count << "." << std::endl;
+			exit(0);
+		}
+
+		// Second pass: store the grain IDs (every chunk now knows where its first voxel is).
+		std::vector<size_t> offsets(used_chunks, 0);
+		for (size_t c = 1; c < used_chunks; ++c) offsets[c] = offsets[c - 1] + chunks[c - 1].count;
+		parallel_for(used_chunks, [&](size_t c) { scan_chunk(&chunks[c], voxels + offsets[c]); });
+	}
+};
\ No newline at end of file
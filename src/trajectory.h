@@ -0,0 +1,170 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include "trajectory_recorder.h"
+#include "mapped_file.h"
+#include "spin_field.h"
+#include "types.h"
+
+// Reconstructs the lattice at any timestep from a recorded trajectory (see trajectory_recorder.h for the format).
+class trajectory
+{
+private:
+	static uint64_t get_u64(const unsigned char *data)
+	{
+		uint64_t value = 0;
+		for (char i = 7; i >= 0; --i) value = value << 8 | data[i];
+		return value;
+	}
+	static double get_time(uint64_t bits)
+	{
+		double time;
+		memcpy(&time, &bits, sizeof(time));
+		return time;
+	}
+	static uint64_t get_varint(const unsigned char **data, const unsigned char *end)
+	{
+		uint64_t value = 0;
+		for (char shift = 0; *data < end && shift < 70; shift += 7)
+		{
+			unsigned char byte = *(*data)++;
+			value |= (uint64_t)(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) return value;
+		}
+		std::cout << "Error: Corrupt trajectory chunk." << std::endl;
+		exit(0);
+	}
+
+	// A chunk within a mapped trajectory.
+	struct chunk_t
+	{
+		unsigned char type;
+		double time;
+		uint64_t entry_count;
+		const unsigned char *payload, *end;
+	};
+
+	// Read the chunk header at pos (returns false at the end of the file, or at a chunk that was cut off).
+	static bool read_chunk(const unsigned char *pos, const unsigned char *file_end, chunk_t *chunk)
+	{
+		if ((size_t)(file_end - pos) < trajectory_recorder_t::CHUNK_HEADER_SIZE) return false;
+
+		uint64_t size = get_u64(pos + 1);
+		chunk->type = pos[0];
+		chunk->time = get_time(get_u64(pos + 9));
+		chunk->entry_count = get_u64(pos + 17);
+		chunk->payload = pos + trajectory_recorder_t::CHUNK_HEADER_SIZE;
+		if ((uint64_t)(file_end - chunk->payload) < size) return false;
+		chunk->end = chunk->payload + size;
+		return true;
+	}
+
+public:
+	// The events that were applied on top of the keyframe by a replay.
+	struct replay_stats_t
+	{
+		double keyframe_time = 0;
+		size_t flips = 0, transitions = 0;
+	};
+
+	// Reconstruct the grain IDs of every voxel at a timestep (the state after every flip up to and including that time).
+	static replay_stats_t replay(const char *fname, double timestep, spin_field_t *field)
+	{
+		mapped_file_t file(fname);
+		const unsigned char *data = reinterpret_cast<const unsigned char *>(file.begin()), *end = data + file.size();
+		if (file.size() < trajectory_recorder_t::HEADER_SIZE || memcmp(data, trajectory_recorder_t::magic(), 8) != 0)
+		{
+			std::cout << "Error: " << fname << " is not a grainsim trajectory." << std::endl;
+			exit(0);
+		}
+		field->side_length = get_u64(data + 8) & 0xffffffff;
+		size_t voxel_count = (size_t)field->side_length * field->side_length * field->side_length;
+
+		// Find the last keyframe at or before the timestep (skipping from header to header).
+		const unsigned char *key_pos = nullptr;
+		chunk_t chunk;
+		for (const unsigned char *pos = data + trajectory_recorder_t::HEADER_SIZE; read_chunk(pos, end, &chunk); pos = chunk.end)
+		{
+			if (chunk.type == trajectory_recorder_t::CHUNK_KEYFRAME)
+			{
+				if (chunk.time > timestep) break;
+				key_pos = pos;
+			}
+		}
+		if (key_pos == nullptr)
+		{
+			std::cout << "Error: " << fname << " has no keyframe at or before T = " << timestep << "." << std::endl;
+			exit(0);
+		}
+
+		replay_stats_t stats;
+		read_chunk(key_pos, end, &chunk);
+		stats.keyframe_time = chunk.time;
+
+		field->spins.resize(voxel_count);
+		const unsigned char *pos = chunk.payload;
+		for (size_t i = 0; i < voxel_count;)
+		{
+			uint32_t value = get_varint(&pos, chunk.end);
+			uint64_t run = get_varint(&pos, chunk.end);
+			if (run == 0 || run > voxel_count - i)
+			{
+				std::cout << "Error: Corrupt trajectory keyframe." << std::endl;
+				exit(0);
+			}
+			std::fill(field->spins.begin() + i, field->spins.begin() + i + run, value);
+			i += run;
+		}
+
+		// Apply the events that follow the keyframe, up to the timestep.
+		for (const unsigned char *chunk_pos = chunk.end; read_chunk(chunk_pos, end, &chunk) && chunk.time <= timestep; chunk_pos = chunk.end)
+		{
+			if (chunk.type != trajectory_recorder_t::CHUNK_EVENTS) continue;
+
+			uint64_t last_time_bits = trajectory_recorder_t::time_bits(chunk.time);
+			size_t index = 0;
+			pos = chunk.payload;
+			for (uint64_t e = 0; e < chunk.entry_count; ++e)
+			{
+				uint64_t tag = get_varint(&pos, chunk.end);
+				uint32_t spin = 0;
+				if (tag == 1)
+				{
+					get_varint(&pos, chunk.end);
+					get_varint(&pos, chunk.end);
+				}
+				else
+				{
+					uint64_t zigzag = tag >> 1;
+					index += (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+					spin = get_varint(&pos, chunk.end);
+				}
+				last_time_bits ^= get_varint(&pos, chunk.end);
+				if (get_time(last_time_bits) > timestep) return stats;
+
+				if (tag == 1)
+				{
+					++stats.transitions;
+				}
+				else
+				{
+					if (index >= voxel_count)
+					{
+						std::cout << "Error: Corrupt trajectory event." << std::endl;
+						exit(0);
+					}
+					field->spins[index] = spin;
+					++stats.flips;
+				}
+			}
+		}
+
+		return stats;
+	}
+};
\ No newline at end of file
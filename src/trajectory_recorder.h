@@ -0,0 +1,214 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <memory>
+
+#include "output_pipeline.h"
+#include "restart_io.h"
+#include "types.h"
+
+/*
+
+A flip-event trajectory (.gst), which records every flip and boundary transition of a run so that the lattice can be reconstructed
+at any timestep (see trajectory.h). All values are little-endian.
+
+	char[8]		magic ("GRAINTR1")
+	uint32		side length
+	uint32		reserved (0)
+	...			chunks
+
+Every chunk starts with a header:
+
+	uint8		chunk type (0 = keyframe, 1 = events)
+	uint64		payload size (in bytes)
+	uint64		the simulation time of the chunk (as the bits of a double; the time of the first event for event chunks)
+	uint64		the number of entries in the payload
+
+Keyframe payloads hold the original grain IDs of every voxel (in lattice order) as pairs of varints (value, run length).
+Event payloads hold a series of events, each starting with a varint tag:
+	flips			tag = zigzag(voxel index - previous flip's voxel index) << 1, followed by the varint new grain ID
+	transitions		tag = 1, followed by the varint grain IDs of the boundary's pair
+and followed by the varint XOR of the bits of its time with the bits of the previous event's time (or of the chunk's time).
+Chunks are self-contained, so a reader can skip from header to header and start decoding at any keyframe.
+
+*/
+class trajectory_recorder_t
+{
+public:
+	static const char *magic()
+	{
+		return "GRAINTR1";
+	}
+	static const size_t HEADER_SIZE = 16, CHUNK_HEADER_SIZE = 25;
+	enum chunk_type_t : unsigned char { CHUNK_KEYFRAME = 0, CHUNK_EVENTS = 1 };
+
+	static void put_u64(unsigned char *out, uint64_t value)
+	{
+		for (char i = 0; i < 8; ++i) out[i] = (value >> (i * 8)) & 0xff;
+	}
+	static void put_varint(std::vector<unsigned char> *out, uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			out->push_back((value & 0x7f) | 0x80);
+			value >>= 7;
+		}
+		out->push_back(value);
+	}
+	static uint64_t time_bits(double time)
+	{
+		uint64_t bits;
+		memcpy(&bits, &time, sizeof(bits));
+		return bits;
+	}
+
+private:
+	// Event chunks are handed to the writer once they grow past this size.
+	static const size_t CHUNK_SIZE = 1 << 20;
+
+	std::ofstream file;
+	// Writes the chunks in the background (a single writer keeps them in order).
+	std::unique_ptr<output_pipeline_t> writer;
+	// The number of bytes written so far (including the file that was resumed; only touched by the writer once it runs).
+	uint64_t written = 0;
+
+	// The current event chunk.
+	std::vector<unsigned char> events;
+	uint64_t event_count = 0;
+	uint64_t chunk_time_bits = 0, last_time_bits = 0;
+	size_t last_index = 0;
+
+	// Write a chunk to the file (on the writer thread).
+	void write_chunk(chunk_type_t type, uint64_t start_time_bits, uint64_t entry_count, const std::vector<unsigned char> &payload)
+	{
+		unsigned char header[CHUNK_HEADER_SIZE];
+		header[0] = type;
+		put_u64(header + 1, payload.size());
+		put_u64(header + 9, start_time_bits);
+		put_u64(header + 17, entry_count);
+		file.write(reinterpret_cast<const char *>(header), CHUNK_HEADER_SIZE);
+		file.write(reinterpret_cast<const char *>(payload.data()), payload.size());
+		written += CHUNK_HEADER_SIZE + payload.size();
+	}
+
+	// Start a new event at the given time.
+	void begin_event(double time)
+	{
+		uint64_t bits = time_bits(time);
+		if (event_count == 0) chunk_time_bits = last_time_bits = bits;
+		++event_count;
+	}
+	void end_event(double time)
+	{
+		uint64_t bits = time_bits(time);
+		put_varint(&events, bits ^ last_time_bits);
+		last_time_bits = bits;
+		if (events.size() >= CHUNK_SIZE) flush();
+	}
+
+public:
+	// Open the trajectory file (queue_size chunks may wait for the writer before recording blocks).
+	// When resuming from a restart file, the file is cut back to the size it had when the restart file was written and appended to.
+	void open(const std::string &path, coord_t side_length, size_t queue_size, long resume_offset = -1)
+	{
+		std::cout << "Recording the trajectory to " << path << std::endl;
+
+		writer.reset(new output_pipeline_t(1, queue_size));
+		events.reserve(CHUNK_SIZE + 64);
+
+		if (open_resumable_file(&file, path, resume_offset, std::ios::binary))
+		{
+			written = resume_offset;
+			return;
+		}
+
+		unsigned char header[HEADER_SIZE] = {};
+		memcpy(header, magic(), 8);
+		for (char i = 0; i < 4; ++i) header[8 + i] = (side_length >> (i * 8)) & 0xff;
+		file.write(reinterpret_cast<const char *>(header), HEADER_SIZE);
+		written = HEADER_SIZE;
+	}
+
+	// Record a flip of the voxel at a lattice index to a new (original) grain ID. Events must be recorded in time order.
+	void record_flip(size_t index, uint32_t spin, double time)
+	{
+		begin_event(time);
+		int64_t delta = (int64_t)index - (int64_t)last_index;
+		put_varint(&events, ((uint64_t)delta << 1 ^ (uint64_t)(delta >> 63)) << 1);
+		put_varint(&events, spin);
+		last_index = index;
+		end_event(time);
+	}
+
+	// Record the transition of the boundary between two (original) grain IDs.
+	void record_transition(uint32_t a_spin, uint32_t b_spin, double time)
+	{
+		begin_event(time);
+		put_varint(&events, 1);
+		put_varint(&events, a_spin);
+		put_varint(&events, b_spin);
+		end_event(time);
+	}
+
+	// Record the full state of the lattice (its original grain IDs in lattice order), which replays can start from.
+	// The keyframe is encoded and written by the writer.
+	void record_keyframe(std::vector<uint32_t> spins, double time)
+	{
+		flush();
+
+		std::shared_ptr<std::vector<uint32_t> > values = std::make_shared<std::vector<uint32_t> >();
+		values->swap(spins);
+		uint64_t bits = time_bits(time);
+		writer->submit([this, values, bits]()
+		{
+			std::vector<unsigned char> payload;
+			uint64_t run_count = 0;
+			for (size_t i = 0; i < values->size();)
+			{
+				size_t run = 1;
+				while (i + run < values->size() && (*values)[i + run] == (*values)[i]) ++run;
+				put_varint(&payload, (*values)[i]);
+				put_varint(&payload, run);
+				++run_count;
+				i += run;
+			}
+			write_chunk(CHUNK_KEYFRAME, bits, run_count, payload);
+		});
+	}
+
+	// Hand the current event chunk to the writer.
+	void flush()
+	{
+		if (event_count == 0) return;
+
+		std::shared_ptr<std::vector<unsigned char> > payload = std::make_shared<std::vector<unsigned char> >();
+		payload->swap(events);
+		events.reserve(CHUNK_SIZE + 64);
+		uint64_t bits = chunk_time_bits, count = event_count;
+		writer->submit([this, payload, bits, count]() { write_chunk(CHUNK_EVENTS, bits, count, *payload); });
+
+		event_count = 0;
+		last_index = 0;
+	}
+
+	// Get the size of the trajectory file (writing everything recorded so far first).
+	long offset()
+	{
+		flush();
+		writer->drain();
+		std::flush(file);
+		return written;
+	}
+
+	void close()
+	{
+		offset();
+		writer.reset();
+		file.close();
+	}
+};
\ No newline at end of file
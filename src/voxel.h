@@ -2,6 +2,7 @@
 
 #include "types.h"
 #include "boundaries2.h"
+#include "lattice_features.h"
 
 // An object that represents a single voxel within the lattice.
 #pragma pack(push, 1)
@@ -22,6 +23,8 @@ public:
 	activ_t activity;
 	// The index of this voxel within the lattice.
 	size_t index;
+	// The number of occupied neighbor slots (a voxel with any neighbor slot lies on a grain boundary).
+	unsigned char neighbor_count;
 
 	voxel_t()
 	{
@@ -30,14 +33,16 @@ public:
 			neighbor_spins[i] = neighbor_probs[i] = 0;
 		}
 		spin = activity = 0;
+		neighbor_count = 0;
 	}
 
 	// Set the probability that this voxel will flip to a certain grain (returns the resulting change in voxel activity).
+	template <typename F = all_lattice_features_t>
 	activ_t set_neighbor(spin_t nspin, activ_t prob, boundary_tracker_t *blist)
 	{
 		if (prob == 0)
 		{
-			return remove_neighbor(nspin, blist);
+			return remove_neighbor<F>(nspin, blist);
 		}
 
 		char nindex = -1;
@@ -67,7 +72,8 @@ public:
 			neighbor_spins[nindex] = nspin;
 			neighbor_probs[nindex] = prob;
 			activity += prob;
-			blist->add_to_boundary(spin, nspin, index, neighbor_spins);
+			++neighbor_count;
+			if (F::boundary_tracking) blist->add_to_boundary<F::junctions>(spin, nspin, index, neighbor_spins);
 			return prob;
 		}
 		else
@@ -79,6 +85,12 @@ public:
 		}
 	}
 
+	// Check if this voxel lies on a grain boundary.
+	bool on_boundary()
+	{
+		return neighbor_count > 0;
+	}
+
 	bool has_neighbor(spin_t nspin)
 	{
 		for (char i = 0; i < NEIGH_COUNT; ++i)
@@ -92,6 +104,7 @@ public:
 	}
 
 	// Remove a certain grain from the neighbor list (returns the resulting change in voxel activity).
+	template <typename F = all_lattice_features_t>
 	activ_t remove_neighbor(spin_t nspin, boundary_tracker_t *blist)
 	{
 		for (char i = 0; i < NEIGH_COUNT; ++i)
@@ -100,14 +113,32 @@ public:
 			{
 				neighbor_spins[i] = NO_NEIGHBOR;
 				activity -= neighbor_probs[i];
-				blist->remove_from_boundary(spin, nspin, index, neighbor_spins);
+				--neighbor_count;
+				if (F::boundary_tracking) blist->remove_from_boundary<F::junctions>(spin, nspin, index, neighbor_spins);
 				return -neighbor_probs[i];
 			}
 		}
 		return 0;
 	}
 
+	// Scale the probability that this voxel will flip to a certain grain by a ratio (returns the resulting change in voxel activity).
+	activ_t scale_neighbor(spin_t nspin, activ_t ratio)
+	{
+		for (char i = 0; i < NEIGH_COUNT; ++i)
+		{
+			if (neighbor_spins[i] == nspin)
+			{
+				activ_t delta = neighbor_probs[i] * ratio - neighbor_probs[i];
+				neighbor_probs[i] += delta;
+				activity += delta;
+				return delta;
+			}
+		}
+		return 0;
+	}
+
 	// Remove all neighbors from the list (returns the resulting change in voxel activity).
+	template <typename F = all_lattice_features_t>
 	activ_t reset(boundary_tracker_t *blist)
 	{
 		activ_t delta = 0;
@@ -116,11 +147,12 @@ public:
 			if (neighbor_spins[i] != NO_NEIGHBOR)
 			{
 				delta -= neighbor_probs[i];
-				blist->remove_from_boundary(spin, neighbor_spins[i], index, neighbor_spins);
+				if (F::boundary_tracking) blist->remove_from_boundary<F::junctions>(spin, neighbor_spins[i], index, neighbor_spins);
 			}
 			neighbor_spins[i] = NO_NEIGHBOR;
 		}
 		activity = 0;
+		neighbor_count = 0;
 		return delta;
 	}
 
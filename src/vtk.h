@@ -5,8 +5,16 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <vector>
+#include <cstdint>
 
 #include "lattice.h"
+#include "snapshot.h"
+#include "raw_lattice.h"
+#include "spin_field.h"
+#include "mapped_file.h"
+#include "text_scanner.h"
+#include "parallel.h"
 #include "types.h"
 
 // A simple class that allows for reading from and writing to .vtk files.
@@ -37,62 +45,225 @@ private:
 		return true;
 	}
 
+	// The number of voxels converted and written at once by the binary writers.
+	static const size_t WRITE_BLOCK_SIZE = 1 << 20;
+
+	static bool host_is_little_endian()
+	{
+		const uint16_t one = 1;
+		return *reinterpret_cast<const unsigned char *>(&one) == 1;
+	}
+
+	// Reverse the byte order of a 32-bit value.
+	static uint32_t swap_bytes(uint32_t value)
+	{
+		return (value >> 24) | ((value >> 8) & 0x0000ff00) | ((value << 8) & 0x00ff0000) | (value << 24);
+	}
+
+	// Write the grain IDs of a spin field as 32-bit integers (swapping them in large blocks if needed).
+	static void write_spin_blocks(std::ofstream *file, const spin_field_t &field, bool big_endian)
+	{
+		size_t voxel_count = field.voxel_count();
+		if (big_endian != host_is_little_endian())
+		{
+			file->write(reinterpret_cast<const char *>(field.spins.data()), voxel_count * sizeof(uint32_t));
+			return;
+		}
+
+		std::vector<uint32_t> block(std::min(voxel_count, WRITE_BLOCK_SIZE));
+		for (size_t begin = 0; begin < voxel_count; begin += block.size())
+		{
+			size_t count = std::min(block.size(), voxel_count - begin);
+			for (size_t i = 0; i < count; ++i)
+			{
+				block[i] = swap_bytes(field.spins[begin + i]);
+			}
+			file->write(reinterpret_cast<const char *>(block.data()), count * sizeof(uint32_t));
+		}
+	}
+
+	// Read 32-bit grain IDs into the voxels of a lattice.
+	static void read_spin_blocks(std::ifstream *file, lattice_t *lattice, bool big_endian)
+	{
+		size_t voxel_count = (size_t)lattice->side_length * lattice->side_length * lattice->side_length;
+		bool swap = big_endian == host_is_little_endian();
+		std::vector<uint32_t> block(std::min(voxel_count, WRITE_BLOCK_SIZE));
+
+		for (size_t begin = 0; begin < voxel_count; begin += block.size())
+		{
+			size_t count = std::min(block.size(), voxel_count - begin);
+			if (!file->read(reinterpret_cast<char *>(block.data()), count * sizeof(uint32_t)))
+			{
+				std::cout << "Error: Unexpected end of binary voxel data." << std::endl;
+				exit(0);
+			}
+			for (size_t i = 0; i < count; ++i)
+			{
+				lattice->voxels[begin + i].spin = swap ? swap_bytes(block[i]) : block[i];
+			}
+		}
+	}
+
+	// Get the value of an XML attribute within a tag (returns an empty string if it is not present).
+	static std::string xml_attribute(const std::string &tag, const char *name)
+	{
+		std::string key = std::string(name) + "=\"";
+		size_t start = tag.find(key);
+		if (start == std::string::npos) return std::string();
+
+		start += key.length();
+		return tag.substr(start, tag.find('"', start) - start);
+	}
+
 public:
-	// Create a lattice object from a .vtk file.
+	// The formats that lattices can be written in.
+	enum format_t : char
+	{
+		// Legacy VTK, ASCII RECTILINEAR_GRID (the original format).
+		FORMAT_ASCII,
+		// Legacy VTK, BINARY STRUCTURED_POINTS.
+		FORMAT_BINARY,
+		// XML VTK ImageData (.vti) with raw appended data.
+		FORMAT_XML,
+		// The native compressed snapshot format (.gss, see snapshot.h), which is written through a snapshot_writer_t.
+		FORMAT_SNAPSHOT,
+		// The raw binary lattice format (.gsr, see raw_lattice.h), which loads without parsing.
+		FORMAT_RAW
+	};
+
+	// Get the file extension for a format.
+	static const char *extension(format_t format)
+	{
+		if (format == FORMAT_XML) return ".vti";
+		if (format == FORMAT_SNAPSHOT) return ".gss";
+		if (format == FORMAT_RAW) return ".gsr";
+		return ".vtk";
+	}
+
+	// Get the format to write a file in from its extension (legacy .vtk files are written as ASCII).
+	static format_t format_of(const char *fname)
+	{
+		std::string str = std::string(fname);
+
+		if (str_ends_with(str, ".vti")) return FORMAT_XML;
+		if (str_ends_with(str, ".gss")) return FORMAT_SNAPSHOT;
+		if (str_ends_with(str, ".gsr")) return FORMAT_RAW;
+		if (!str_ends_with(str, ".vtk"))
+		{
+			std::cout << "Error: Unrecognized file format." << std::endl;
+			exit(0);
+		}
+		return FORMAT_ASCII;
+	}
+
+	// Save a spin field in the given format (snapshots are written as standalone keyframes).
+	static void to_file(const char *fname, const spin_field_t &field, format_t format)
+	{
+		switch (format)
+		{
+		case FORMAT_ASCII:
+			to_vtk(fname, field);
+			break;
+		case FORMAT_BINARY:
+			to_vtk_binary(fname, field);
+			break;
+		case FORMAT_XML:
+			to_vti(fname, field);
+			break;
+		case FORMAT_SNAPSHOT:
+			snapshot_writer_t().write(fname, field);
+			break;
+		case FORMAT_RAW:
+			raw_lattice::to_raw(fname, field);
+			break;
+		}
+	}
+
+	// Save a lattice object in the given format.
+	static void to_file(const char *fname, lattice_t *lattice, format_t format)
+	{
+		to_file(fname, spin_field_t(lattice), format);
+	}
+
+	// Create a lattice object from a .vtk file (ASCII or BINARY).
 	static lattice_t *from_vtk(const char *fname, bool init=true)
 	{
 		std::cout << "Loading VTK file " << fname << std::endl;
 
-		lattice_t *new_cube;
+		mapped_file_t file(fname);
+		const char *pos = file.begin(), *end = file.end();
+		lattice_t *new_cube = nullptr;
+		size_t cell_count = 0;
+		bool binary = false;
 
-		std::ifstream vtkfile(fname);
-		std::string line;
-		spin_t index = 0;
-		char load_state = 0;
-		bool end_loop = false;
-		while (std::getline(vtkfile, line))
+		// Read the header up to the CELL_DATA line.
+		while (pos < end && cell_count == 0)
 		{
-			// Cases govern status of parser.
-			// Read cube dimension sizes, then skip to CELL_DATA section, then read voxel spins.
-			switch (load_state)
+			std::string line = text_scanner::next_line(&pos, end);
+			if (str_starts_with(line, "BINARY")) binary = true;
+
+			if (str_starts_with(line, "DIMENSIONS"))
 			{
-			case 0:
-				if (str_starts_with(line, "DIMENSIONS"))
+				std::istringstream ss(line.substr(10));
+				coord_t x, y, z;
+				if (!(ss >> x >> y >> z) || x != y || x != z || x < 2)
 				{
-					std::istringstream ss(line);
-					std::string word;
-					ss >> word; // skip "DIMENSIONS"
-					ss >> word;
+					std::cout << "Error: VTK files must have cubic DIMENSIONS." << std::endl;
+					exit(0);
+				}
+				new_cube = new lattice_t(x - 1);
+			}
+			else if (str_starts_with(line, "CELL_DATA"))
+			{
+				cell_count = std::stoull(line.substr(9));
+			}
+		}
 
-					coord_t dim = std::stoi(word) - 1;
-					new_cube = new lattice_t(dim);
+		if (new_cube == nullptr || cell_count != (size_t)new_cube->side_length * new_cube->side_length * new_cube->side_length)
+		{
+			std::cout << "Error: The CELL_DATA count in " << fname << " does not match its DIMENSIONS." << std::endl;
+			exit(0);
+		}
 
-					++load_state;
-				}
-				break;
-			case 1:
-				if (str_starts_with(line, "CELL_DATA")) ++load_state;
-				break;
-			case 2:
-				if (line[0] >= '0' && line[0] <= '9')
-				{
-					new_cube->voxels[index++].spin = std::stoul(line);
-					++load_state;
-				}
-				break;
-			case 3:
-				if (line[0] >= '0' && line[0] <= '9')
+		if (binary)
+		{
+			// Binary data (big-endian 32-bit integers) starts right after the lookup table line.
+			std::string line;
+			while (pos < end && !str_starts_with(line, "LOOKUP_TABLE"))
+			{
+				line = text_scanner::next_line(&pos, end);
+				if (str_starts_with(line, "SCALARS") && line.find(" int") == std::string::npos && line.find(" unsigned_int") == std::string::npos)
 				{
-					new_cube->voxels[index++].spin = std::stoul(line);
+					std::cout << "Error: Binary VTK files must contain 32-bit integer grain IDs." << std::endl;
+					exit(0);
 				}
-				else end_loop = true;
-				break;
+			}
+			if ((size_t)(end - pos) < cell_count * sizeof(uint32_t))
+			{
+				std::cout << "Error: Unexpected end of binary voxel data." << std::endl;
+				exit(0);
 			}
 
-			if (end_loop) break;
+			const char *data = pos;
+			bool swap = host_is_little_endian();
+			voxel_t *voxels = new_cube->voxels;
+			parallel_for((cell_count + WRITE_BLOCK_SIZE - 1) / WRITE_BLOCK_SIZE, [=](size_t block)
+			{
+				size_t block_end = std::min(cell_count, (block + 1) * WRITE_BLOCK_SIZE);
+				for (size_t i = block * WRITE_BLOCK_SIZE; i < block_end; ++i)
+				{
+					uint32_t spin;
+					memcpy(&spin, data + i * sizeof(uint32_t), sizeof(uint32_t));
+					voxels[i].spin = swap ? swap_bytes(spin) : spin;
+				}
+			});
+		}
+		else
+		{
+			// Skip to the first line of grain IDs (past SCALARS and LOOKUP_TABLE).
+			while (pos < end && (*pos < '0' || *pos > '9')) text_scanner::next_line(&pos, end);
+			text_scanner::parse_spins(fname, pos, end, new_cube->voxels, cell_count);
 		}
-
-		vtkfile.close();
 
 		std::cout << "Done loading!" << std::endl;
 		if (init)
@@ -103,87 +274,180 @@ public:
 		return new_cube;
 	}
 
-	// Save a lattice object to a .vtk file.
-	static void to_vtk(const char *fname, lattice_t *lattice)
+	// Save a spin field to a .vtk file.
+	static void to_vtk(const char *fname, const spin_field_t &field)
 	{
 		std::ofstream vtkfile(fname);
 
 		std::cout << "Writing to " << fname << std::endl;
 
 		vtkfile << "# vtk DataFile Version 2.0\n data set from May6 1\nASCII\nDATASET RECTILINEAR_GRID\n";
-		vtkfile << "DIMENSIONS " << (lattice->side_length + 1) << " " << (lattice->side_length + 1) << " " << (lattice->side_length + 1) << " \n";
+		vtkfile << "DIMENSIONS " << (field.side_length + 1) << " " << (field.side_length + 1) << " " << (field.side_length + 1) << " \n";
 
-		vtkfile << "X_COORDINATES " << (lattice->side_length + 1) << " Float \n";
-		for (size_t i = 0; i < lattice->side_length + 1; ++i)
+		vtkfile << "X_COORDINATES " << (field.side_length + 1) << " Float \n";
+		for (size_t i = 0; i < field.side_length + 1; ++i)
 		{
 			vtkfile << i << '\n';
 		}
-		vtkfile << "Y_COORDINATES " << (lattice->side_length + 1) << " Float \n";
-		for (size_t i = 0; i < lattice->side_length + 1; ++i)
+		vtkfile << "Y_COORDINATES " << (field.side_length + 1) << " Float \n";
+		for (size_t i = 0; i < field.side_length + 1; ++i)
 		{
 			vtkfile << i << '\n';
 		}
-		vtkfile << "Z_COORDINATES " << (lattice->side_length + 1) << " Float \n";
-		for (size_t i = 0; i < lattice->side_length + 1; ++i)
+		vtkfile << "Z_COORDINATES " << (field.side_length + 1) << " Float \n";
+		for (size_t i = 0; i < field.side_length + 1; ++i)
 		{
 			vtkfile << i << '\n';
 		}
-		vtkfile << "CELL_DATA " << (lattice->side_length * lattice->side_length * lattice->side_length) << " \n";
+		vtkfile << "CELL_DATA " << (field.side_length * field.side_length * field.side_length) << " \n";
 		vtkfile << "SCALARS GrainIDs int  1\nLOOKUP_TABLE default\n";
-		for (size_t i = 0; i < (lattice->side_length * lattice->side_length * lattice->side_length); ++i)
+		for (size_t i = 0; i < field.voxel_count(); ++i)
 		{
-			vtkfile << lattice->voxels[i].spin << '\n';
+			vtkfile << field.spins[i] << '\n';
 		}
 		
 		vtkfile.close();
 	}
 
-	// Create a lattice object from a .ph file.
-	static lattice_t *from_ph(const char *fname, bool init=true)
+	// Save a spin field to a legacy binary .vtk file (STRUCTURED_POINTS, big-endian as the format requires).
+	static void to_vtk_binary(const char *fname, const spin_field_t &field)
 	{
-		std::cout << "Loading PH file " << fname << std::endl;
+		std::ofstream vtkfile(fname, std::ios::binary);
 
-		lattice_t *new_cube;
+		std::cout << "Writing to " << fname << std::endl;
+
+		vtkfile << "# vtk DataFile Version 3.0\n data set from grainsim\nBINARY\nDATASET STRUCTURED_POINTS\n";
+		vtkfile << "DIMENSIONS " << (field.side_length + 1) << " " << (field.side_length + 1) << " " << (field.side_length + 1) << "\n";
+		vtkfile << "ORIGIN 0 0 0\nSPACING 1 1 1\n";
+		vtkfile << "CELL_DATA " << field.voxel_count() << "\n";
+		vtkfile << "SCALARS GrainIDs int 1\nLOOKUP_TABLE default\n";
+		write_spin_blocks(&vtkfile, field, true);
+		vtkfile << "\n";
+
+		vtkfile.close();
+	}
 
-		std::ifstream phfile(fname);
-		std::string line;
-		spin_t index = 0;
-		char load_state = 0;
-		bool end_loop = false;
-		while (std::getline(phfile, line))
+	// Save a spin field to an XML ImageData (.vti) file, with the grain IDs as raw appended data.
+	static void to_vti(const char *fname, const spin_field_t &field)
+	{
+		std::ofstream vtifile(fname, std::ios::binary);
+
+		std::cout << "Writing to " << fname << std::endl;
+
+		size_t side = field.side_length;
+		uint64_t byte_count = side * side * side * sizeof(uint32_t);
+		std::string extent = "0 " + std::to_string(side) + " 0 " + std::to_string(side) + " 0 " + std::to_string(side);
+
+		vtifile << "<?xml version=\"1.0\"?>\n";
+		vtifile << "<VTKFile type=\"ImageData\" version=\"1.0\" byte_order=\"" << (host_is_little_endian() ? "LittleEndian" : "BigEndian") << "\" header_type=\"UInt64\">\n";
+		vtifile << "  <ImageData WholeExtent=\"" << extent << "\" Origin=\"0 0 0\" Spacing=\"1 1 1\">\n";
+		vtifile << "    <Piece Extent=\"" << extent << "\">\n";
+		vtifile << "      <CellData Scalars=\"GrainIDs\">\n";
+		vtifile << "        <DataArray type=\"Int32\" Name=\"GrainIDs\" format=\"appended\" offset=\"0\"/>\n";
+		vtifile << "      </CellData>\n";
+		vtifile << "    </Piece>\n";
+		vtifile << "  </ImageData>\n";
+		vtifile << "  <AppendedData encoding=\"raw\">\n   _";
+		vtifile.write(reinterpret_cast<const char *>(&byte_count), sizeof(byte_count));
+		write_spin_blocks(&vtifile, field, !host_is_little_endian());
+		vtifile << "\n  </AppendedData>\n</VTKFile>\n";
+
+		vtifile.close();
+	}
+
+	// Create a lattice object from an XML ImageData (.vti) file with raw appended data (as written by to_vti()).
+	static lattice_t *from_vti(const char *fname, bool init=true)
+	{
+		std::cout << "Loading VTI file " << fname << std::endl;
+
+		std::ifstream vtifile(fname, std::ios::binary);
+		std::string header, tag;
+		lattice_t *new_cube = nullptr;
+		bool big_endian = false, header_64 = false;
+
+		// Read tags until the appended data begins (the data itself starts right after the '_' marker).
+		while (std::getline(vtifile, tag, '>'))
 		{
-			// Cases govern status of parser.
-			switch (load_state)
+			if (tag.find("<VTKFile") != std::string::npos)
 			{
-			case 0:
+				big_endian = xml_attribute(tag, "byte_order") == "BigEndian";
+				header_64 = xml_attribute(tag, "header_type") == "UInt64";
+			}
+			else if (tag.find("<ImageData") != std::string::npos)
 			{
-				std::istringstream ss(line);
-				std::string word;
-				ss >> word;
-				coord_t dim = std::stoi(word);
-				new_cube = new lattice_t(dim);
-
-				++load_state;
-
-				break;
+				std::istringstream ss(xml_attribute(tag, "WholeExtent"));
+				coord_t x0, x1, y0, y1, z0, z1;
+				if (!(ss >> x0 >> x1 >> y0 >> y1 >> z0 >> z1) || x1 - x0 != y1 - y0 || x1 - x0 != z1 - z0)
+				{
+					std::cout << "Error: VTI files must contain a cubic extent." << std::endl;
+					exit(0);
+				}
+				new_cube = new lattice_t(x1 - x0);
 			}
-			case 1:
-			case 2:
-				++load_state;
-				break;
-			case 3:
-				if (line[0] >= '0' && line[0] <= '9')
+			else if (tag.find("<DataArray") != std::string::npos)
+			{
+				std::string type = xml_attribute(tag, "type");
+				if ((type != "Int32" && type != "UInt32") || xml_attribute(tag, "format") != "appended" || std::stoul(xml_attribute(tag, "offset")) != 0)
 				{
-					new_cube->voxels[index++].spin = std::stoul(line);
+					std::cout << "Error: VTI files must contain a single appended 32-bit integer array." << std::endl;
+					exit(0);
+				}
+			}
+			else if (tag.find("<AppendedData") != std::string::npos)
+			{
+				if (xml_attribute(tag, "encoding") != "raw")
+				{
+					std::cout << "Error: VTI appended data must be raw (not base64)." << std::endl;
+					exit(0);
 				}
-				else end_loop = true;
 				break;
 			}
+		}
+
+		if (new_cube == nullptr || !vtifile)
+		{
+			std::cout << "Error: Could not parse VTI file." << std::endl;
+			exit(0);
+		}
+
+		// Skip to the data marker, then the block size header.
+		char c;
+		while (vtifile.get(c) && c != '_');
+		vtifile.ignore(header_64 ? 8 : 4);
+		read_spin_blocks(&vtifile, new_cube, big_endian);
+
+		vtifile.close();
+
+		std::cout << "Done loading!" << std::endl;
+		if (init)
+		{
+			new_cube->init();
+		}
 
-			if (end_loop) break;
+		return new_cube;
+	}
+
+	// Create a lattice object from a .ph file.
+	static lattice_t *from_ph(const char *fname, bool init=true)
+	{
+		std::cout << "Loading PH file " << fname << std::endl;
+
+		mapped_file_t file(fname);
+		const char *pos = file.begin(), *end = file.end();
+
+		// The first line holds the dimensions, and the grain IDs start after two more header lines.
+		std::istringstream ss(text_scanner::next_line(&pos, end));
+		coord_t x, y, z;
+		if (!(ss >> x) || x < 1 || ((ss >> y >> z) && (x != y || x != z)))
+		{
+			std::cout << "Error: PH files must have cubic dimensions." << std::endl;
+			exit(0);
 		}
+		text_scanner::next_line(&pos, end);
+		text_scanner::next_line(&pos, end);
 
-		phfile.close();
+		lattice_t *new_cube = new lattice_t(x);
+		text_scanner::parse_spins(fname, pos, end, new_cube->voxels, (size_t)x * x * x);
 
 		std::cout << "Done loading!" << std::endl;
 		if (init)
@@ -207,6 +471,18 @@ public:
 		{
 			return from_ph(fname, init);
 		}
+		else if (str_ends_with(str, ".vti"))
+		{
+			return from_vti(fname, init);
+		}
+		else if (str_ends_with(str, ".gss"))
+		{
+			return snapshot::from_snapshot(fname, init);
+		}
+		else if (str_ends_with(str, ".gsr"))
+		{
+			return raw_lattice::from_raw(fname, init);
+		}
 		else
 		{
 			std::cout << "Error: Unrecognized file format." << std::endl;